@@ -0,0 +1,377 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2026 Paulo Pagliosa.                              |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: BenchMain.cpp
+// ========
+// Main function for cg BVH micro-benchmark, which compares the SIMD
+// leaf tests of a triangle mesh BVH with the scalar ones.
+//
+// Author: Paulo Pagliosa
+// Last revision: 17/10/2026
+
+#include "core/Exception.h"
+#include "geometry/MeshSweeper.h"
+#include "geometry/TriangleMeshBVH.h"
+#include "utils/MeshReader.h"
+#include "utils/Stopwatch.h"
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+using namespace cg;
+
+namespace
+{ // begin namespace
+
+struct Options
+{
+  const char* meshFile{};
+  int sphereSegments{256};
+  int rayCount{1 << 18};
+  int repeatCount{5};
+  int width{2};
+  bool leafTriangles{};
+
+}; // Options
+
+void
+usage()
+{
+  puts("Usage: cgbench [options] [mesh.obj]\n"
+    "Options:\n"
+    "  -s, --segments N     segments of the sphere used if no mesh is\n"
+    "                       given (default: 256)\n"
+    "  -r, --rays N         rays per query (default: 262144)\n"
+    "  -n, --repeat N       runs per query, of which the fastest one is\n"
+    "                       reported (default: 5)\n"
+    "  --width N            BVH width: 2, 4, or 8 (default: 2)\n"
+    "  --leaf-triangles     copy the triangles in leaf order");
+}
+
+bool
+parseInt(const char* s, int& value, int min)
+{
+  char* end;
+  auto n = strtol(s, &end, 10);
+
+  if (end == s || *end != '\0' || n < min || n > INT_MAX)
+    return false;
+  value = int(n);
+  return true;
+}
+
+bool
+parseOptions(int argc, char** argv, Options& options)
+{
+  for (auto i = 1; i < argc; ++i)
+  {
+    auto arg = argv[i];
+
+    if (*arg != '-')
+    {
+      if (options.meshFile != nullptr)
+        return false;
+      options.meshFile = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--leaf-triangles"))
+    {
+      options.leafTriangles = true;
+      continue;
+    }
+    if (i + 1 == argc)
+      return false;
+
+    auto value = argv[++i];
+    auto match = [arg](const char* shortName, const char* longName)
+    {
+      return (shortName && !strcmp(arg, shortName)) || !strcmp(arg, longName);
+    };
+
+    if (match("-s", "--segments"))
+    {
+      if (!parseInt(value, options.sphereSegments, 3))
+        return false;
+    }
+    else if (match("-r", "--rays"))
+    {
+      if (!parseInt(value, options.rayCount, 1))
+        return false;
+    }
+    else if (match("-n", "--repeat"))
+    {
+      if (!parseInt(value, options.repeatCount, 1))
+        return false;
+    }
+    else if (match(nullptr, "--width"))
+    {
+      if (!parseInt(value, options.width, 2))
+        return false;
+    }
+    else
+      return false;
+  }
+  return true;
+}
+
+// Makes packets of 8x8 rays, as the primary rays of the pixels of 8x8
+// tiles of images of the mesh seen from random viewpoints around it.
+// The rays of a packet have directions of the same signs (apart from
+// the ones near the axes of the view), thus are traversed together
+std::vector<Ray3f>
+makeRays(const Bounds3f& bounds, uint32_t rayCount)
+{
+  constexpr auto packetSide = 8;
+  constexpr auto packetSize = packetSide * packetSide;
+  std::vector<Ray3f> rays;
+  std::mt19937 rng{2026};
+  std::uniform_real_distribution<float> u{0, 1};
+  auto center = bounds.center();
+  auto radius = bounds.diagonalLength() * 0.5f;
+
+  rays.reserve(rayCount);
+  while (rays.size() < rayCount)
+  {
+    auto z = 2 * u(rng) - 1;
+    auto phi = 2 * math::pi<float> * u(rng);
+    auto r = std::sqrt(1 - z * z);
+    vec3f n{r * std::cos(phi), r * std::sin(phi), z};
+    auto eye = center + n * (radius * 2.5f);
+    // Orthonormal basis of the view, whose direction is -n
+    auto up = std::fabs(n.z) < 0.9f ? vec3f{0, 0, 1} : vec3f{1, 0, 0};
+    auto su = up.cross(n).versor();
+    auto sv = n.cross(su);
+    // Tile of a 256x256 image of the mesh
+    auto x0 = int(u(rng) * (256 - packetSide));
+    auto y0 = int(u(rng) * (256 - packetSide));
+
+    for (auto k = 0; k < packetSize && rays.size() < rayCount; ++k)
+    {
+      auto x = ((x0 + k % packetSide + 0.5f) / 256 - 0.5f) * 2 * radius;
+      auto y = ((y0 + k / packetSide + 0.5f) / 256 - 0.5f) * 2 * radius;
+      auto p = center + su * x + sv * y;
+
+      rays.emplace_back(eye, (p - eye).versor());
+    }
+  }
+  return rays;
+}
+
+struct Result
+{
+  double time{math::Limits<double>::inf()};
+  uint32_t hitCount;
+  double distanceSum;
+
+}; // Result
+
+enum class Query
+{
+  ClosestHit,
+  AnyHit,
+  ClosestHitPacket,
+  AnyHitPacket
+};
+
+const char* queryNames[]
+{
+  "closest hit",
+  "any hit",
+  "closest hit (packets)",
+  "any hit (packets)"
+};
+
+Result
+run(const TriangleMeshBVH& bvh,
+  const std::vector<Ray3f>& rays,
+  Query query,
+  int repeatCount)
+{
+  constexpr auto packetSize = BVHBase::maxPacketSize;
+  auto n = uint32_t(rays.size());
+  std::vector<Intersection> hits(n);
+  Result result;
+
+  for (auto i = 0; i < repeatCount; ++i)
+  {
+    Stopwatch timer;
+
+    result.hitCount = 0;
+    for (auto& hit : hits)
+      hit.distance = math::Limits<float>::inf();
+    timer.start();
+    switch (query)
+    {
+      case Query::ClosestHit:
+        for (uint32_t r = 0; r < n; ++r)
+          result.hitCount += bvh.intersect(rays[r], hits[r]);
+        break;
+      case Query::AnyHit:
+        for (uint32_t r = 0; r < n; ++r)
+          result.hitCount += bvh.intersect(rays[r]);
+        break;
+      case Query::ClosestHitPacket:
+      case Query::AnyHitPacket:
+        for (uint32_t r = 0; r < n; r += packetSize)
+        {
+          auto m = std::min(packetSize, n - r);
+          std::span<const Ray3f> packet{rays.data() + r, m};
+          auto mask = query == Query::AnyHitPacket ?
+            bvh.intersect(packet) :
+            bvh.intersect(packet, {hits.data() + r, m});
+
+          result.hitCount += std::popcount(mask);
+        }
+        break;
+    }
+    result.time = std::min(result.time, timer.time());
+  }
+  // The distances of closest hits, which must be equal for the SIMD
+  // and scalar tests
+  result.distanceSum = 0;
+  if (query == Query::ClosestHit || query == Query::ClosestHitPacket)
+    for (const auto& hit : hits)
+      if (hit.distance < math::Limits<float>::inf())
+        result.distanceSum += hit.distance;
+  return result;
+}
+
+int
+bench(const Options& options)
+{
+  Reference<TriangleMesh> mesh = options.meshFile == nullptr ?
+    MeshSweeper::makeSphere(options.sphereSegments) :
+    MeshReader::readOBJ(options.meshFile);
+
+  if (mesh == nullptr)
+    runtimeError("Unable to read mesh '%s'", options.meshFile);
+
+  Stopwatch timer;
+
+  timer.start();
+
+  Reference<TriangleMeshBVH> bvh = new TriangleMeshBVH{*mesh};
+
+  bvh->setWidth(options.width);
+  bvh->setLeafTriangles(options.leafTriangles);
+  printf("Mesh: %d triangles\n", mesh->data().triangleCount);
+  printf("BVH: %zu nodes, width %u, built in %g ms\n",
+    bvh->size(),
+    bvh->width(),
+    timer.time());
+
+  auto rays = makeRays(bvh->bounds(), options.rayCount);
+  auto ns = [&rays](const Result& r)
+  {
+    return r.time * 1e6 / rays.size();
+  };
+  auto blockSize = TriangleMeshBVH::triangleBlockSize();
+
+  // A build without SIMD tests (e.g., with BVH_NO_SIMD defined) has
+  // only the scalar timings to report
+  if (blockSize == 1)
+  {
+    puts("SIMD leaf tests: none (scalar build)");
+    printf("\n%-24s%14s%10s\n", "Query (ns per ray)", "scalar", "hits");
+    bvh->setTriangleBlocks(false);
+    for (auto q = 0; q < 4; ++q)
+    {
+      auto scalar = run(*bvh, rays, Query(q), options.repeatCount);
+
+      printf("%-24s%14.1f%10u\n", queryNames[q], ns(scalar), scalar.hitCount);
+    }
+    return EXIT_SUCCESS;
+  }
+  printf("SIMD leaf tests: %u triangles per block\n", blockSize);
+  printf("\n%-24s%14s%14s%10s%10s\n",
+    "Query (ns per ray)",
+    "SIMD",
+    "scalar",
+    "speedup",
+    "hits");
+
+  auto mismatches = 0;
+
+  for (auto q = 0; q < 4; ++q)
+  {
+    auto query = Query(q);
+
+    bvh->setTriangleBlocks(true);
+
+    auto simd = run(*bvh, rays, query, options.repeatCount);
+
+    bvh->setTriangleBlocks(false);
+
+    auto scalar = run(*bvh, rays, query, options.repeatCount);
+
+    printf("%-24s%14.1f%14.1f%9.2fx%10u\n",
+      queryNames[q],
+      ns(simd),
+      ns(scalar),
+      scalar.time / simd.time,
+      simd.hitCount);
+    // Both tests must find the same hits. The distances may differ in
+    // their last bits, since the compiler can contract the scalar code
+    // into fused multiply-adds
+    if (simd.hitCount != scalar.hitCount ||
+      std::fabs(simd.distanceSum - scalar.distanceSum) >
+      1e-5 * std::fabs(scalar.distanceSum))
+    {
+      printf("  mismatch: %u/%u hits, distance sums %g/%g\n",
+        simd.hitCount,
+        scalar.hitCount,
+        simd.distanceSum,
+        scalar.distanceSum);
+      ++mismatches;
+    }
+  }
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // end namespace
+
+int
+main(int argc, char** argv)
+{
+  Options options;
+
+  if (!parseOptions(argc, argv, options))
+  {
+    usage();
+    return EXIT_FAILURE;
+  }
+  try
+  {
+    return bench(options);
+  }
+  catch (const std::exception& e)
+  {
+    printf("Error: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+}
@@ -28,7 +28,7 @@
 // Source file for cg demo main window.
 //
 // Author: Paulo Pagliosa
-// Last revision: 13/07/2023
+// Last revision: 17/10/2026
 
 #include "graphics/Application.h"
 #include "graphics/AssetFolder.h"
@@ -268,6 +268,17 @@ MainWindow::mainMenu()
         0.01f,
         RayTracer::minMinWeight,
         1.0f);
+      ImGui::DragInt("Max Subdivision Level",
+        &_maxSubdivisionLevel,
+        1.0f,
+        0,
+        RayTracer::maxMaxSubdivisionLevel);
+      ImGui::DragFloat("Color Threshold", &_colorThreshold, 0.01f, 0, 1.0f);
+      ImGui::DragInt("Light Samples",
+        &_lightSampleCount,
+        1.0f,
+        0,
+        RayTracer::maxLightSampleCount);
       ImGui::EndMenu();
     }
     if (ImGui::BeginMenu("Tools"))
@@ -326,29 +337,62 @@ void
 MainWindow::renderScene()
 {
   if (_viewMode != ViewMode::Renderer)
+  {
+    if (_rayTracer != nullptr)
+      _rayTracer->cancelRendering();
     return;
+  }
 
   auto camera = CameraProxy::current();
 
   if (nullptr == camera)
     camera = editor()->camera();
-  if (_image == nullptr)
+
+  auto cameraStamp = camera->update();
+
+  // The commands of the main menu can change the scene and the ray
+  // tracer settings, thus the image is not rendered while a menu is
+  // open. Otherwise, it is rendered again if the camera has changed
+  if (ImGui::IsPopupOpen("", ImGuiPopupFlags_AnyPopupId))
+  {
+    if (_rayTracer != nullptr)
+      _rayTracer->cancelRendering();
+    _renderCamera = nullptr;
+  }
+  else if (_image == nullptr ||
+    _renderCamera != camera ||
+    _renderCameraStamp != cameraStamp)
   {
-    _image = new GLImage{width(), height()};
+    if (_image == nullptr)
+      _image = new GLImage{width(), height()};
     if (_rayTracer == nullptr)
       _rayTracer = new RayTracer{*scene(), *camera};
     else
+    {
+      _rayTracer->cancelRendering();
       _rayTracer->setCamera(*camera);
+    }
     _rayTracer->setMaxRecursionLevel(_maxRecursionLevel);
     _rayTracer->setMinWeight(_minWeight);
-    _rayTracer->renderImage(*_image);
+    _rayTracer->setMaxSubdivisionLevel(_maxSubdivisionLevel);
+    _rayTracer->setColorThreshold(_colorThreshold);
+    _rayTracer->setLightSampleCount(_lightSampleCount);
+    _rayTracer->startRendering(width(), height());
+    _renderCamera = camera;
+    _renderCameraStamp = cameraStamp;
+  }
+  if (_image != nullptr)
+  {
+    _rayTracer->updateImage(*_image);
+    _image->draw(0, 0);
   }
-  _image->draw(0, 0);
 }
 
 bool
 MainWindow::onResize(int width, int height)
 {
+  if (_rayTracer != nullptr)
+    _rayTracer->cancelRendering();
   _viewMode = ViewMode::Editor;
   _image = nullptr;
   return true;
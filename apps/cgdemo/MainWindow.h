@@ -28,7 +28,7 @@
 // Class definition for cg demo main window.
 //
 // Author: Paulo Pagliosa
-// Last revision: 19/07/2023
+// Last revision: 17/10/2026
 
 #ifndef __MainWindow_h
 #define __MainWindow_h
@@ -67,8 +67,14 @@ private:
   AssetFolderRef _sceneFolder;
   Reference<RayTracer> _rayTracer;
   Reference<GLImage> _image;
+  // Camera and camera timestamp of the image being rendered
+  const Camera* _renderCamera{};
+  uint32_t _renderCameraStamp{};
   int _maxRecursionLevel{6};
   float _minWeight{RayTracer::minMinWeight};
+  int _maxSubdivisionLevel{};
+  float _colorThreshold{0.1f};
+  int _lightSampleCount{};
 
   static MeshMap _defaultMeshes;
 
@@ -28,12 +28,18 @@
 // Source file for simple ray tracer.
 //
 // Author: Paulo Pagliosa
-// Last revision: 30/07/2023
+// Last revision: 17/10/2026
 
+#include "core/Parallel.h"
 #include "graphics/Camera.h"
+#include "graphics/MemoryImage.h"
 #include "utils/Stopwatch.h"
 #include "RayTracer.h"
+#include <algorithm>
+#include <bit>
+#include <cinttypes>
 #include <iostream>
+#include <iterator>
 
 using namespace std;
 
@@ -49,6 +55,59 @@ printElapsedTime(const char* s, Stopwatch::ms_time time)
   printf("%sElapsed time: %g ms\n", s, time);
 }
 
+inline void
+adjustRGB(Color& color)
+{
+  if (color.r > 1.0f)
+    color.r = 1.0f;
+  if (color.g > 1.0f)
+    color.g = 1.0f;
+  if (color.b > 1.0f)
+    color.b = 1.0f;
+}
+
+// Returns the greatest difference between the RGB components of the
+// colors at the corners of a pixel area
+inline float
+colorRange(const Color c[4])
+{
+  auto d = 0.0f;
+
+  for (auto i = 0; i < 3; ++i)
+  {
+    auto min = c[0][i], max = min;
+
+    for (auto k = 1; k < 4; ++k)
+      if (c[k][i] < min)
+        min = c[k][i];
+      else if (c[k][i] > max)
+        max = c[k][i];
+    d = math::max(d, max - min);
+  }
+  return d;
+}
+
+// Returns a pseudorandom number in [0,1) for the dimension dim of
+// the sample of the pixel (x,y), which is the same in every rendering
+inline float
+jitter(uint32_t x, uint32_t y, uint32_t sample, uint32_t dim)
+{
+  auto h = x * 0x8da6b343u ^ y * 0xd8163841u ^ sample * 0xcb1ab31fu ^
+    dim * 0x165667b1u;
+
+  // MurmurHash3 finalizer
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return float(h >> 8) * 0x1p-24f;
+}
+
+// A refitted scene BVH whose SAH cost is greater than this ratio
+// times its cost when built is rebuilt
+constexpr auto maxBVHCostRatio = 2.0f;
+
 } // end namespace
 
 
@@ -64,15 +123,91 @@ RayTracer::RayTracer(SceneBase& scene, Camera& camera):
   // do nothing
 }
 
+RayTracer::~RayTracer()
+{
+  cancelRendering();
+}
+
+RayTracer::Statistics::Counters&
+RayTracer::Statistics::Counters::operator +=(const Counters& other)
+{
+  primaryRays += other.primaryRays;
+  shadowRays += other.shadowRays;
+  reflectionRays += other.reflectionRays;
+  hits += other.hits;
+  tiles += other.tiles;
+  traversalTime += other.traversalTime;
+  shadingTime += other.shadingTime;
+  queryCounters += other.queryCounters;
+  return *this;
+}
+
 void
-RayTracer::update()
+RayTracer::Statistics::Counters::writeJSON(FILE* f,
+  const char* indent) const
 {
-  // Delete current BVH before creating a new one
-  _bvh = nullptr;
+  const auto& q = queryCounters;
+  auto perRay = [n = double(rays())](uint64_t count)
+  {
+    return n > 0 ? count / n : 0.0;
+  };
+
+  fprintf(f, "{\n");
+  fprintf(f, "%s  \"primaryRays\": %" PRIu64 ",\n", indent, primaryRays);
+  fprintf(f, "%s  \"shadowRays\": %" PRIu64 ",\n", indent, shadowRays);
+  fprintf(f,
+    "%s  \"reflectionRays\": %" PRIu64 ",\n",
+    indent,
+    reflectionRays);
+  fprintf(f, "%s  \"hits\": %" PRIu64 ",\n", indent, hits);
+  fprintf(f, "%s  \"tiles\": %u,\n", indent, tiles);
+  fprintf(f, "%s  \"traversalTime\": %g,\n", indent, traversalTime);
+  fprintf(f, "%s  \"shadingTime\": %g,\n", indent, shadingTime);
+  fprintf(f, "%s  \"bvhQueries\": %" PRIu64 ",\n", indent, q.rays);
+  fprintf(f,
+    "%s  \"nodesPerRay\": %g,\n",
+    indent,
+    perRay(q.nodesVisited));
+  fprintf(f,
+    "%s  \"primitivesPerRay\": %g\n",
+    indent,
+    perRay(q.primitivesTested));
+  fprintf(f, "%s}", indent);
+}
+
+void
+RayTracer::Statistics::writeJSON(FILE* f) const
+{
+  fprintf(f, "{\n");
+  fprintf(f, "  \"width\": %d,\n", width);
+  fprintf(f, "  \"height\": %d,\n", height);
+  fprintf(f, "  \"threadCount\": %zu,\n", threads.size());
+  fprintf(f, "  \"updateTime\": %g,\n", updateTime);
+  fprintf(f, "  \"renderTime\": %g,\n", renderTime);
+  fprintf(f, "  \"rays\": %" PRIu64 ",\n", total.rays());
+  fprintf(f, "  \"raysPerSecond\": %g,\n", raysPerSecond());
+  fprintf(f, "  \"primaryRaysPerPixel\": %g,\n", primaryRaysPerPixel());
+  fprintf(f, "  \"total\": ");
+  total.writeJSON(f, "  ");
+  fprintf(f, ",\n  \"threads\": [");
+  for (size_t i = 0; i < threads.size(); ++i)
+  {
+    fprintf(f, i > 0 ? ",\n    " : "\n    ");
+    threads[i].writeJSON(f, "    ");
+  }
+  fprintf(f, "\n  ]\n}\n");
+}
 
+void
+RayTracer::update()
+{
   PrimitiveBVH::PrimitiveArray primitives;
   auto np = uint32_t(0);
+  auto rebuild = _bvh == nullptr;
+  auto refit = false;
 
+  updateLights();
+  // Compare the visible primitives with the ones of the current BVH
   primitives.reserve(_scene->actorCount());
   for (auto actor : _scene->actors())
     if (actor->visible)
@@ -82,11 +217,66 @@ RayTracer::update()
       assert(p != nullptr);
       if (p->canIntersect())
       {
+        if (rebuild || np >= _bvhEntries.size() ||
+          _bvhEntries[np].primitive != p)
+          rebuild = true;
+        else if (_bvhEntries[np].transformStamp != p->transformStamp())
+          refit = true;
         primitives.push_back(p);
         np++;
       }
     }
-  _bvh = new PrimitiveBVH{std::move(primitives)};
+  if (np != _bvhEntries.size())
+    rebuild = true;
+  if (rebuild)
+  {
+    // Delete current BVH before creating a new one
+    _bvh = nullptr;
+    _bvh = new PrimitiveBVH{std::move(primitives)};
+    _bvhEntries.resize(np);
+    for (uint32_t i = 0; i < np; ++i)
+      _bvhEntries[i].primitive = _bvh->primitives()[i];
+  }
+  else if (refit)
+    _bvh->refit(maxBVHCostRatio);
+  else
+    return;
+  for (auto& e : _bvhEntries)
+    e.transformStamp = e.primitive->transformStamp();
+}
+
+void
+RayTracer::updateLights()
+{
+  std::vector<LightEntry> entries;
+
+  // Compare the lights with the ones of the current light BVH
+  entries.reserve(_scene->lightCount());
+  for (auto light : _scene->lights())
+    entries.push_back({light,
+      light->type(),
+      uint32_t(light->flags),
+      light->position(),
+      light->range()});
+  if (entries == _lightEntries)
+    return;
+
+  LightBVH::LightArray lights;
+
+  _infiniteLights.clear();
+  for (auto light : _scene->lights())
+    if (!light->isTurnedOn())
+      continue;
+    else if (light->type() == Light::Type::Directional ||
+      light->flags.isSet(Light::Infinite))
+      _infiniteLights.push_back(light);
+    else
+      lights.push_back(light);
+  // Delete current BVH before creating a new one
+  _lightBVH = nullptr;
+  if (!lights.empty())
+    _lightBVH = new LightBVH{std::move(lights)};
+  _lightEntries = std::move(entries);
 }
 
 void
@@ -96,12 +286,8 @@ RayTracer::render()
 }
 
 void
-RayTracer::renderImage(Image& image)
+RayTracer::setView(int w, int h)
 {
-  Stopwatch timer;
-
-  update();
-  timer.start();
   {
     const auto& m = _camera->cameraToWorldMatrix();
 
@@ -112,8 +298,6 @@ RayTracer::renderImage(Image& image)
   }
 
   // init auxiliary mapping variables
-  auto w = image.width(), h = image.height();
-
   setImageSize(w, h);
   _Iw = math::inverse(float(w));
   _Ih = math::inverse(float(h));
@@ -129,8 +313,10 @@ RayTracer::renderImage(Image& image)
   // init pixel ray
   float F, B;
 
+  _projectionType = _camera->projectionType();
+  _nearPlane = _camera->nearPlane();
   _camera->clippingPlanes(F, B);
-  if (_camera->projectionType() == Camera::Perspective)
+  if (_projectionType == Camera::Perspective)
   {
     // distance from the camera position to a frustum back corner
     auto z = B / F * 0.5f;
@@ -139,34 +325,196 @@ RayTracer::renderImage(Image& image)
   _pixelRay.tMin = F;
   _pixelRay.tMax = B;
   _pixelRay.set(_camera->position(), -_vrc.n);
-  _numberOfRays = _numberOfHits = 0;
+}
+
+void
+RayTracer::renderImage(Image& image)
+{
+  Stopwatch timer;
+
+  cancelRendering();
+  timer.start();
+  update();
+  // Shape BVHs are built or refitted on their first use after being
+  // changed, which must not happen in concurrent rendering threads
+  for (const auto& e : _bvhEntries)
+    e.primitive->bounds();
+  _statistics.updateTime = timer.lap();
+  setView(image.width(), image.height());
+
+  auto memoryImage = dynamic_cast<const MemoryImage*>(&image);
+
+  _clampColors = memoryImage == nullptr || !memoryImage->isHDR();
   scan(image);
+  _statistics.renderTime = timer.lap();
 
-  auto et = timer.time();
+  const auto& s = _statistics;
 
-  std::cout << "\nNumber of rays: " << _numberOfRays;
-  std::cout << "\nNumber of hits: " << _numberOfHits;
-  printElapsedTime("\nDONE! ", et);
+  std::cout << "\nPrimary rays per pixel: " << s.primaryRaysPerPixel();
+  std::cout << "\nNumber of rays: " << s.total.rays();
+  std::cout << "\nNumber of hits: " << s.total.hits;
+  std::cout << "\nRays per second: " << s.raysPerSecond();
+  if (s.total.queryCounters.rays > 0)
+  {
+    std::cout << "\nBVH query counters:\n";
+    s.total.queryCounters.writeJSON();
+  }
+  printElapsedTime("\nDONE! ", s.renderTime);
 }
 
 void
-RayTracer::setPixelRay(float x, float y)
+RayTracer::startRendering(int width, int height, uint32_t maxSamples)
+{
+  cancelRendering();
+  setView(width, height);
+  _clampColors = true;
+  _sampleSums.assign(size_t(width) * height, Color::black);
+  _frame = ImageBuffer{width, height};
+  _frameChanged = false;
+  _sampleCount = 0;
+  _rendering = true;
+  _renderThread = std::thread{&RayTracer::renderProgressive,
+    this,
+    math::max(maxSamples, 1u)};
+}
+
+void
+RayTracer::cancelRendering()
+{
+  if (!_renderThread.joinable())
+    return;
+  _canceled = true;
+  _renderThread.join();
+  _canceled = _rendering = false;
+}
+
+bool
+RayTracer::updateImage(Image& image)
+{
+  std::lock_guard lock{_frameLock};
+
+  if (!_frameChanged)
+    return false;
+  image.setData(_frame);
+  _frameChanged = false;
+  return true;
+}
+
+void
+RayTracer::renderProgressive(uint32_t maxSamples)
+{
+  update();
+  for (const auto& e : _bvhEntries)
+    e.primitive->bounds();
+  // Coarse passes: the pixel at the corner of each block of a pass is
+  // traced, except if it was traced by a previous pass, and its color
+  // fills the block. The pass with blocks of one pixel completes the
+  // first sample of every pixel, which is taken at the pixel center
+  for (auto s = coarsestBlockSize; s > 0 && !_canceled; s >>= 1)
+    renderPass(s, 1);
+  if (!_canceled)
+    _sampleCount = 1;
+  // Refinement passes: one jittered sample per pixel is accumulated,
+  // unless the pixels have already been adaptively supersampled
+  if (_maxSubdivisionLevel > 0)
+    maxSamples = 1;
+  for (auto k = 2u; k <= maxSamples && !_canceled; ++k)
+  {
+    renderPass(1, k);
+    if (!_canceled)
+      _sampleCount = k;
+  }
+  _rendering = false;
+}
+
+void
+RayTracer::renderPass(int blockSize, uint32_t sample)
+//[]---------------------------------------------------[]
+//|  Render a progressive rendering pass                |
+//|  @param side of the blocks of pixels of the pass    |
+//|  @param index of the sample of the pass (from 1)    |
+//[]---------------------------------------------------[]
+{
+  auto nx = (_viewport.w + taskTileSize - 1) / taskTileSize;
+  auto ny = (_viewport.h + taskTileSize - 1) / taskTileSize;
+  auto n = uint32_t(nx * ny);
+  auto nt = _threadCount > 0 ? _threadCount : hardwareThreadCount();
+  std::vector<TraceContext> contexts(nt);
+  auto s = math::inverse(float(sample));
+
+  parallelTasks(n, [&](uint32_t k, uint32_t t)
+  {
+    if (_canceled)
+      return;
+
+    auto& context = contexts[t];
+
+    context.stopwatch.start();
+    auto x = int(k % nx) * taskTileSize;
+    auto y = int(k / nx) * taskTileSize;
+    auto w = math::min(taskTileSize, _viewport.w - x);
+    auto h = math::min(taskTileSize, _viewport.h - y);
+    Color colors[taskTileSize][taskTileSize];
+
+    if (blockSize == 1 && _maxSubdivisionLevel > 0)
+    {
+      shootAdaptive(x, y, w, h, colors, context);
+      for (auto j = 0; j < h; ++j)
+        for (auto i = 0; i < w; ++i)
+          _sampleSums[size_t(y + j) * _viewport.w + x + i] = colors[j][i];
+    }
+    else
+      for (auto j = 0; j < h; j += blockSize)
+        for (auto i = 0; i < w; i += blockSize)
+        {
+          auto px = x + i, py = y + j;
+          auto& sum = _sampleSums[size_t(py) * _viewport.w + px];
+
+          if (sample > 1)
+            sum += shoot(px + jitter(px, py, sample, 0),
+              py + jitter(px, py, sample, 1),
+              context);
+          else if (blockSize == coarsestBlockSize ||
+            px % (2 * blockSize) != 0 || py % (2 * blockSize) != 0)
+            sum = shoot(px + 0.5f, py + 0.5f, context);
+
+          auto color = sum * s;
+          auto bw = math::min(blockSize, w - i);
+          auto bh = math::min(blockSize, h - j);
+
+          for (auto bj = 0; bj < bh; ++bj)
+            for (auto bi = 0; bi < bw; ++bi)
+              colors[j + bj][i + bi] = color;
+        }
+
+    std::lock_guard lock{_frameLock};
+
+    for (auto j = 0; j < h; ++j)
+      for (auto i = 0; i < w; ++i)
+        _frame(x + i, y + j) = colors[j][i];
+    _frameChanged = true;
+  }, nt);
+}
+
+void
+RayTracer::setPixelRay(Ray3f& ray, float x, float y) const
 //[]---------------------------------------------------[]
 //|  Set pixel ray                                      |
+//|  @param the ray (output)                            |
 //|  @param x coordinate of the pixel                   |
 //|  @param y cordinates of the pixel                   |
 //[]---------------------------------------------------[]
 {
   auto p = imageToWindow(x, y);
 
-  switch (_camera->projectionType())
+  switch (_projectionType)
   {
     case Camera::Perspective:
-      _pixelRay.direction = (p - _camera->nearPlane() * _vrc.n).versor();
+      ray.direction = (p - _nearPlane * _vrc.n).versor();
       break;
 
     case Camera::Parallel:
-      _pixelRay.origin = _camera->position() + p;
+      ray.origin = _pixelRay.origin + p;
       break;
   }
 }
@@ -174,62 +522,266 @@ RayTracer::setPixelRay(float x, float y)
 void
 RayTracer::scan(Image& image)
 {
-  ImageBuffer scanLine{_viewport.w, 1};
-
-  for (auto j = 0; j < _viewport.h; j++)
+  // The image is split into tiles of taskTileSize x taskTileSize
+  // pixels, which are rendered by concurrent threads from the top
+  // tile row to the bottom one. A memory image takes the tiles as
+  // they are rendered, which lets it stream the completed rows to
+  // a file. Since other images (e.g., a GLImage) may not be written
+  // by other threads, the tiles are copied into a frame buffer which
+  // is copied into the image at the end
+  auto nx = (_viewport.w + taskTileSize - 1) / taskTileSize;
+  auto ny = (_viewport.h + taskTileSize - 1) / taskTileSize;
+  auto n = uint32_t(nx * ny);
+  auto nt = _threadCount > 0 ? _threadCount : hardwareThreadCount();
+  std::vector<TraceContext> contexts(nt);
+  auto memoryImage = dynamic_cast<MemoryImage*>(&image);
+  ImageBuffer frame;
+  std::atomic<uint32_t> tileCount{};
+
+  if (memoryImage == nullptr)
+    frame = ImageBuffer{_viewport.w, _viewport.h};
+  parallelTasks(n, [&](uint32_t k, uint32_t t)
   {
-    auto y = (float)j + 0.5f;
-
-    printf("Scanning line %d of %d\r", j + 1, _viewport.h);
-    for (auto i = 0; i < _viewport.w; i++)
-      scanLine[i] = shoot((float)i + 0.5f, y);
-    image.setData(0, j, scanLine);
-  }
+    auto& context = contexts[t];
+    auto x = int(k % nx) * taskTileSize;
+    auto y = int(ny - 1 - k / nx) * taskTileSize;
+    auto w = math::min(taskTileSize, _viewport.w - x);
+    auto h = math::min(taskTileSize, _viewport.h - y);
+    Color colors[taskTileSize][taskTileSize];
+
+    context.stopwatch.start();
+    ++context.tiles;
+    BVHBase::queryCounters() = {};
+    if (_maxSubdivisionLevel > 0)
+      shootAdaptive(x, y, w, h, colors, context);
+    else
+      for (auto j = 0; j < h; j += tileSize)
+        for (auto i = 0; i < w; i += tileSize)
+          shoot(x + i,
+            y + j,
+            math::min(tileSize, w - i),
+            math::min(tileSize, h - j),
+            &colors[j][i],
+            context);
+    context.queryCounters += BVHBase::queryCounters();
+    if (memoryImage != nullptr)
+      memoryImage->setTile(x, y, w, h, colors[0], taskTileSize);
+    else
+      for (auto j = 0; j < h; ++j)
+        for (auto i = 0; i < w; ++i)
+          frame(x + i, y + j) = colors[j][i];
+    k = ++tileCount;
+    if (t == 0)
+      printf("Rendering tile %u of %u\r", k, n);
+  }, nt);
+  if (memoryImage == nullptr)
+    image.setData(frame);
+  _statistics.width = _viewport.w;
+  _statistics.height = _viewport.h;
+  _statistics.total = {};
+  _statistics.threads.assign(contexts.begin(), contexts.end());
+  for (const auto& c : contexts)
+    _statistics.total += c;
 }
 
 Color
-RayTracer::shoot(float x, float y)
+RayTracer::shoot(float x, float y, TraceContext& context) const
 //[]---------------------------------------------------[]
 //|  Shoot a pixel ray                                  |
 //|  @param x coordinate of the pixel                   |
 //|  @param y cordinates of the pixel                   |
+//|  @param counters of the calling thread              |
 //|  @return RGB color of the pixel                     |
 //[]---------------------------------------------------[]
 {
   // set pixel ray
-  setPixelRay(x, y);
+  auto pixelRay = _pixelRay;
+
+  setPixelRay(pixelRay, x, y);
+  ++context.primaryRays;
 
   // trace pixel ray
-  Color color = trace(_pixelRay, 0, 1);
+  Intersection hit;
+
+  context.stopwatch.lap();
+
+  auto found = intersect(pixelRay, hit, context);
+
+  context.traversalTime += context.stopwatch.lap();
+
+  auto color = found ? shade(pixelRay, hit, 0, 1, context) : background();
+
+  context.shadingTime += context.stopwatch.lap();
 
   // adjust RGB color
-  if (color.r > 1.0f)
-    color.r = 1.0f;
-  if (color.g > 1.0f)
-    color.g = 1.0f;
-  if (color.b > 1.0f)
-    color.b = 1.0f;
+  if (_clampColors)
+    adjustRGB(color);
   // return pixel color
   return color;
 }
 
+void
+RayTracer::shoot(int i,
+  int j,
+  int w,
+  int h,
+  Color* colors,
+  TraceContext& context) const
+//[]---------------------------------------------------[]
+//|  Shoot the pixel rays of a tile as a ray packet     |
+//|  @param i x coordinate of the first tile pixel      |
+//|  @param j y coordinate of the first tile pixel      |
+//|  @param w width of the tile                         |
+//|  @param h height of the tile                        |
+//|  @param colors of the tile pixels, in rows of       |
+//|  taskTileSize colors (output)                       |
+//|  @param counters of the calling thread              |
+//[]---------------------------------------------------[]
+{
+  constexpr auto maxSize = tileSize * tileSize;
+  Ray3f rays[maxSize];
+  Intersection hits[maxSize];
+  auto n = 0;
+
+  // set pixel rays
+  for (auto y = 0; y < h; y++)
+    for (auto x = 0; x < w; x++)
+    {
+      rays[n] = _pixelRay;
+      setPixelRay(rays[n++], (float)(i + x) + 0.5f, (float)(j + y) + 0.5f);
+    }
+
+  // trace pixel rays
+  context.stopwatch.lap();
+
+  auto hitMask = _bvh->intersect({rays, size_t(n)}, {hits, size_t(n)});
+
+  context.traversalTime += context.stopwatch.lap();
+  context.primaryRays += n;
+  context.hits += std::popcount(hitMask);
+  n = 0;
+  for (auto y = 0; y < h; y++)
+    for (auto x = 0; x < w; x++, n++)
+    {
+      auto color = (hitMask >> n) & 1 ?
+        shade(rays[n], hits[n], 0, 1, context) :
+        background();
+
+      if (_clampColors)
+        adjustRGB(color);
+      colors[y * taskTileSize + x] = color;
+    }
+  context.shadingTime += context.stopwatch.lap();
+}
+
+void
+RayTracer::shootAdaptive(int i,
+  int j,
+  int w,
+  int h,
+  Color colors[][taskTileSize],
+  TraceContext& context) const
+//[]---------------------------------------------------[]
+//|  Shoot the pixel rays of a tile with adaptive       |
+//|  supersampling                                      |
+//|  @param i x coordinate of the first tile pixel      |
+//|  @param j y coordinate of the first tile pixel      |
+//|  @param w width of the tile                         |
+//|  @param h height of the tile                        |
+//|  @param colors of the tile pixels (output)          |
+//|  @param counters of the calling thread              |
+//[]---------------------------------------------------[]
+{
+  // The colors at the pixel corners are shared by neighbouring pixels,
+  // thus the ones of the top and bottom of a row of the tile are kept
+  Color corners[2][taskTileSize + 1];
+  auto top = corners[0];
+  auto bottom = corners[1];
+  auto shootCorners = [&](Color* row, int y)
+  {
+    for (auto x = 0; x <= w; ++x)
+      row[x] = shoot(float(i + x), float(y), context);
+  };
+
+  shootCorners(top, j);
+  for (auto y = 0; y < h; ++y)
+  {
+    shootCorners(bottom, j + y + 1);
+    for (auto x = 0; x < w; ++x)
+    {
+      const Color c[4]{top[x], top[x + 1], bottom[x], bottom[x + 1]};
+
+      colors[y][x] = subdivide(float(i + x), float(j + y), 1, c, 0, context);
+    }
+    std::swap(top, bottom);
+  }
+}
+
+Color
+RayTracer::subdivide(float x,
+  float y,
+  float size,
+  const Color c[4],
+  uint32_t level,
+  TraceContext& context) const
+//[]---------------------------------------------------[]
+//|  Adaptively supersample a square pixel area         |
+//|  @param x coordinate of the area corner             |
+//|  @param y coordinate of the area corner             |
+//|  @param size of the area                            |
+//|  @param colors at the corners (x,y), (x+size,y),    |
+//|  (x,y+size), and (x+size,y+size)                    |
+//|  @param subdivision level of the area               |
+//|  @param counters of the calling thread              |
+//|  @return RGB color of the area                      |
+//[]---------------------------------------------------[]
+{
+  if (level >= _maxSubdivisionLevel || colorRange(c) <= _colorThreshold)
+    return (c[0] + c[1] + c[2] + c[3]) * 0.25f;
+  size *= 0.5f;
+
+  auto xm = x + size, xr = xm + size;
+  auto ym = y + size, yt = ym + size;
+  auto cm = shoot(xm, ym, context);
+  auto cb = shoot(xm, y, context);
+  auto cl = shoot(x, ym, context);
+  auto cr = shoot(xr, ym, context);
+  auto ct = shoot(xm, yt, context);
+  const Color q0[4]{c[0], cb, cl, cm};
+  const Color q1[4]{cb, c[1], cm, cr};
+  const Color q2[4]{cl, cm, c[2], ct};
+  const Color q3[4]{cm, cr, ct, c[3]};
+
+  ++level;
+  return (subdivide(x, y, size, q0, level, context) +
+    subdivide(xm, y, size, q1, level, context) +
+    subdivide(x, ym, size, q2, level, context) +
+    subdivide(xm, ym, size, q3, level, context)) * 0.25f;
+}
+
 Color
-RayTracer::trace(const Ray3f& ray, uint32_t level, float weight)
+RayTracer::trace(const Ray3f& ray,
+  uint32_t level,
+  float weight,
+  TraceContext& context) const
 //[]---------------------------------------------------[]
 //|  Trace a ray                                        |
 //|  @param the ray                                     |
 //|  @param recursion level                             |
 //|  @param ray weight                                  |
+//|  @param counters of the calling thread              |
 //|  @return color of the ray                           |
 //[]---------------------------------------------------[]
 {
   if (level > _maxRecursionLevel)
     return Color::black;
-  ++_numberOfRays;
+  ++context.reflectionRays;
 
   Intersection hit;
 
-  return intersect(ray, hit) ? shade(ray, hit, level, weight) : background();
+  return intersect(ray, hit, context) ?
+    shade(ray, hit, level, weight, context) :
+    background();
 }
 
 inline constexpr auto
@@ -239,17 +791,20 @@ rt_eps()
 }
 
 bool
-RayTracer::intersect(const Ray3f& ray, Intersection& hit)
+RayTracer::intersect(const Ray3f& ray,
+  Intersection& hit,
+  TraceContext& context) const
 //[]---------------------------------------------------[]
 //|  Ray/object intersection                            |
 //|  @param the ray (input)                             |
 //|  @param information on intersection (output)        |
+//|  @param counters of the calling thread              |
 //|  @return true if the ray intersects an object       |
 //[]---------------------------------------------------[]
 {
   hit.object = nullptr;
   hit.distance = ray.tMax;
-  return _bvh->intersect(ray, hit) ? ++_numberOfHits : false;
+  return _bvh->intersect(ray, hit) ? ++context.hits : false;
 }
 
 inline auto
@@ -262,13 +817,15 @@ Color
 RayTracer::shade(const Ray3f& ray,
   Intersection& hit,
   uint32_t level,
-  float weight)
+  float weight,
+  TraceContext& context) const
 //[]---------------------------------------------------[]
 //|  Shade a point P                                    |
 //|  @param the ray (input)                             |
 //|  @param information on intersection (input)         |
 //|  @param recursion level                             |
 //|  @param ray weight                                  |
+//|  @param counters of the calling thread              |
 //|  @return color at point P                           |
 //[]---------------------------------------------------[]
 {
@@ -289,43 +846,123 @@ RayTracer::shade(const Ray3f& ray,
   auto m = primitive->material();
   auto color = _scene->ambientLight * m->ambient;
   auto P = ray(hit.distance);
-
-  // Compute direct lighting
-  for (auto light : _scene->lights())
+  // Gather the lights inciding at P. The ones with finite range are
+  // found by a query of the light BVH. The buffers of the context are
+  // reused by the recursive calls, which are made after the direct
+  // lighting is computed
+  auto& samples = context.lightSamples;
+  auto addSample = [&](const Light* light)
   {
-    // If the light is turned off, then continue
-    if (!light->isTurnedOn())
-      continue;
-
     vec3f L;
     float d;
 
     // If the point P is out of the light range (for finite
-    // point light or spotlight), then continue
+    // point light or spotlight), then return
     if (!light->lightVector(P, L, d))
-      continue;
+      return;
 
     auto NL = N.dot(L);
 
-    // If light vector is backfaced, then continue
-    if (NL <= 0)
-      continue;
+    // If light vector is not backfaced, then add the sample
+    if (NL > 0)
+      samples.push_back({light, L, d, NL, light->lightColor(d)});
+  };
 
-    auto lightRay = Ray3f{P + L * rt_eps(), L};
+  samples.clear();
+  for (auto light : _infiniteLights)
+    addSample(light);
+  if (_lightBVH != nullptr)
+  {
+    auto& ids = context.lightIds;
 
-    lightRay.tMax = d;
-    ++_numberOfRays;
-    // If the point P is shadowed, then continue
-    if (shadow(lightRay))
-      continue;
+    ids.clear();
+    _lightBVH->query(P, std::back_inserter(ids));
+    for (auto id : ids)
+      addSample(_lightBVH->lights()[id]);
+  }
 
-    auto lc = light->lightColor(d);
+  // The shadow rays toward the lights are traced as ray packets
+  constexpr auto maxLights = PrimitiveBVH::maxPacketSize;
+  const LightSample* lightSamples[maxLights];
+  float lightScales[maxLights];
+  Ray3f lightRays[maxLights];
+  uint32_t lightCount{};
+  auto addLighting = [&]()
+  {
+    auto shadowMask = shadow({lightRays, lightCount}, context);
 
-    color += lc * m->diffuse * NL;
-    if (m->shine <= 0 || (d = R.dot(L)) <= 0)
-      continue;
-    color += lc * m->spot * pow(d, m->shine);
+    for (uint32_t i = 0; i < lightCount; ++i)
+    {
+      // If the point P is shadowed, then continue
+      if ((shadowMask >> i) & 1)
+        continue;
+
+      const auto& sample = *lightSamples[i];
+      auto lc = sample.color * lightScales[i];
+      float d;
+
+      color += lc * m->diffuse * sample.NL;
+      if (m->shine <= 0 || (d = R.dot(sample.L)) <= 0)
+        continue;
+      color += lc * m->spot * pow(d, m->shine);
+    }
+    lightCount = 0;
+  };
+  auto addLight = [&](const LightSample& sample, float scale)
+  {
+    auto& lightRay = lightRays[lightCount];
+
+    lightRay = Ray3f{P + sample.L * rt_eps(), sample.L};
+    lightRay.tMax = sample.distance;
+    lightSamples[lightCount] = &sample;
+    lightScales[lightCount++] = scale;
+    ++context.shadowRays;
+    if (lightCount == maxLights)
+      addLighting();
+  };
+
+  // Compute direct lighting
+  if (_lightSampleCount == 0 || samples.size() <= _lightSampleCount)
+    for (const auto& sample : samples)
+      addLight(sample, 1);
+  else
+  {
+    // The weights are the cumulative sums of the light contribution
+    // estimates, which disregard the material and the shadows
+    auto sum = 0.0f;
+
+    for (auto& sample : samples)
+    {
+      const auto& c = sample.color;
+
+      sample.weight = sum += (c.r + c.g + c.b) * sample.NL;
+    }
+    if (sum > 0)
+    {
+      // The random numbers depend only on P and the recursion level
+      auto hx = std::bit_cast<uint32_t>(P.x) ^
+        std::bit_cast<uint32_t>(P.y) * 0x9e3779b1u;
+      auto hy = std::bit_cast<uint32_t>(P.z);
+      auto n = _lightSampleCount;
+
+      for (uint32_t k = 0; k < n; ++k)
+      {
+        auto u = jitter(hx, hy, level, k) * sum;
+        auto i = std::upper_bound(samples.begin(),
+          samples.end() - 1,
+          u,
+          [](float u, const LightSample& s) { return u < s.weight; });
+        // The probability of the sample is its estimate over the sum
+        auto estimate = i->weight -
+          (i == samples.begin() ? 0 : std::prev(i)->weight);
+
+        if (estimate > 0)
+          addLight(*i, sum / (estimate * n));
+      }
+    }
   }
+  if (lightCount > 0)
+    addLighting();
   // Compute specular reflection
   if (m->specular != Color::black)
   {
@@ -333,7 +970,8 @@ RayTracer::shade(const Ray3f& ray,
     if (weight > _minWeight && level < _maxRecursionLevel)
     {
       auto reflectionRay = Ray3f{P + R * rt_eps(), R};
-      color += m->specular * trace(reflectionRay, level + 1, weight);
+      color += m->specular *
+        trace(reflectionRay, level + 1, weight, context);
     }
   }
   return color;
@@ -350,14 +988,30 @@ RayTracer::background() const
 }
 
 bool
-RayTracer::shadow(const Ray3f& ray)
+RayTracer::shadow(const Ray3f& ray, TraceContext& context) const
 //[]---------------------------------------------------[]
 //|  Verifiy if ray is a shadow ray                     |
 //|  @param the ray (input)                             |
+//|  @param counters of the calling thread              |
 //|  @return true if the ray intersects an object       |
 //[]---------------------------------------------------[]
 {
-  return _bvh->intersect(ray) ? ++_numberOfHits : false;
+  return _bvh->intersect(ray) ? ++context.hits : false;
+}
+
+RayTracer::RayMask
+RayTracer::shadow(std::span<const Ray3f> rays, TraceContext& context) const
+//[]---------------------------------------------------[]
+//|  Verifiy which rays of a packet are shadow rays     |
+//|  @param the rays (input)                            |
+//|  @param counters of the calling thread              |
+//|  @return mask of the rays intersecting an object    |
+//[]---------------------------------------------------[]
+{
+  auto shadowMask = _bvh->intersect(rays);
+
+  context.hits += std::popcount(shadowMask);
+  return shadowMask;
 }
 
 } // end namespace cg
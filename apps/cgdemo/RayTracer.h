@@ -28,15 +28,20 @@
 // Class definition for simple ray tracer.
 //
 // Author: Paulo Pagliosa
-// Last revision: 07/02/2022
+// Last revision: 17/10/2026
 
 #ifndef __RayTracer_h
 #define __RayTracer_h
 
 #include "geometry/Intersection.h"
 #include "graphics/Image.h"
+#include "graphics/LightBVH.h"
 #include "graphics/PrimitiveBVH.h"
 #include "graphics/Renderer.h"
+#include "utils/Stopwatch.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 namespace cg
 { // begin namespace cg
@@ -51,9 +56,65 @@ class RayTracer: public Renderer
 public:
   static constexpr auto minMinWeight = float(0.001);
   static constexpr auto maxMaxRecursionLevel = uint32_t(20);
+  static constexpr auto maxMaxSubdivisionLevel = uint32_t(4);
+  static constexpr auto maxLightSampleCount = uint32_t(64);
+
+  /// Statistics of the last image rendered by renderImage()
+  struct Statistics
+  {
+    /// Counters of a rendering thread, or of all of them. The times,
+    /// in milliseconds, are spent intersecting the primary rays with
+    /// the scene BVH and shading their hits, which includes tracing
+    /// the shadow and reflection rays. The BVH query counters are
+    /// zero unless the BVHs are compiled with BVH_STATS.
+    struct Counters
+    {
+      uint64_t primaryRays;
+      uint64_t shadowRays;
+      uint64_t reflectionRays;
+      uint64_t hits;
+      uint32_t tiles;
+      double traversalTime;
+      double shadingTime;
+      BVHBase::QueryCounters queryCounters;
+
+      auto rays() const
+      {
+        return primaryRays + shadowRays + reflectionRays;
+      }
+
+      Counters& operator +=(const Counters&);
+
+      void writeJSON(FILE* = stdout, const char* indent = "") const;
+
+    }; // Counters
+
+    int width;
+    int height;
+    double updateTime; // ms spent updating the scene BVH
+    double renderTime; // ms spent rendering the pixels (wall clock)
+    Counters total;
+    std::vector<Counters> threads;
+
+    double raysPerSecond() const
+    {
+      return renderTime > 0 ? total.rays() * 1000 / renderTime : 0;
+    }
+
+    double primaryRaysPerPixel() const
+    {
+      auto n = double(width) * height;
+      return n > 0 ? total.primaryRays / n : 0;
+    }
+
+    void writeJSON(FILE* = stdout) const;
+
+  }; // Statistics
 
   RayTracer(SceneBase&, Camera&);
 
+  ~RayTracer() override;
+
   auto minWeight() const
   {
     return _minWeight;
@@ -74,12 +135,189 @@ public:
     _maxRecursionLevel = math::min(rl, maxMaxRecursionLevel);
   }
 
+  /// Returns the maximum subdivision level of the adaptive
+  /// supersampling of the pixels, or zero (the default) if one ray is
+  /// shot through the center of each pixel.
+  auto maxSubdivisionLevel() const
+  {
+    return _maxSubdivisionLevel;
+  }
+
+  /// Sets the maximum subdivision level of the adaptive supersampling.
+  /// When it is greater than zero, rays are shot through the pixel
+  /// corners, and a pixel area is subdivided into four quadrants while
+  /// the colors at its corners differ by more than the color threshold
+  /// in any RGB component, up to the maximum level.
+  void setMaxSubdivisionLevel(uint32_t n)
+  {
+    _maxSubdivisionLevel = math::min(n, maxMaxSubdivisionLevel);
+  }
+
+  auto colorThreshold() const
+  {
+    return _colorThreshold;
+  }
+
+  void setColorThreshold(float t)
+  {
+    _colorThreshold = math::max(t, 0.0f);
+  }
+
+  /// Returns the maximum number of lights sampled at a hit point, or
+  /// zero (the default) if every light inciding at the point is used.
+  auto lightSampleCount() const
+  {
+    return _lightSampleCount;
+  }
+
+  /// Sets the maximum number of lights sampled at a hit point. When
+  /// more lights than that incide at a point, that many shadow rays
+  /// are traced toward lights chosen at random, with probabilities
+  /// proportional to estimates of their unshadowed contributions, and
+  /// the contributions are weighted so that their expected sum is the
+  /// one of all of the lights. The choice depends only on the point,
+  /// thus the noise of the direct lighting is the same in every
+  /// rendering and averages out with more samples per pixel.
+  void setLightSampleCount(uint32_t n)
+  {
+    _lightSampleCount = math::min(n, maxLightSampleCount);
+  }
+
+  /// Returns the number of threads rendering an image, or zero (the
+  /// default) if there is one per hardware thread.
+  auto threadCount() const
+  {
+    return _threadCount;
+  }
+
+  void setThreadCount(uint32_t n)
+  {
+    _threadCount = n;
+  }
+
   void update() override;
   void render() override;
   virtual void renderImage(Image&);
 
+  /// Starts rendering a width x height image progressively in the
+  /// background: coarse blocks of pixels first, then every pixel,
+  /// then up to maxSamples jittered samples per pixel, which are
+  /// averaged. With adaptive supersampling, the pass with every pixel
+  /// is supersampled and is the last one. A rendering in progress is
+  /// canceled. The camera and scene must not be changed until the
+  /// rendering is canceled.
+  void startRendering(int width, int height, uint32_t maxSamples = 16);
+  /// Cancels the progressive rendering in progress, if any, and waits
+  /// for its threads to finish.
+  void cancelRendering();
+
+  /// Returns true if a progressive rendering is in progress.
+  bool isRendering() const
+  {
+    return _rendering;
+  }
+
+  /// Returns the number of samples per pixel of the last completed
+  /// pass of the progressive rendering, or zero if the first pass
+  /// with every pixel has not been completed yet.
+  auto sampleCount() const
+  {
+    return _sampleCount.load();
+  }
+
+  /// Copies the progressive rendering frame into an image, which must
+  /// be called from the thread owning the image (e.g., the one of the
+  /// OpenGL context of a GLImage). Returns false if the frame has not
+  /// changed since the last update.
+  bool updateImage(Image&);
+
+  /// Returns the BVH of the scene, built by update(). The BVH is
+  /// kept between updates: it is rebuilt only if the visible actors
+  /// have changed, and refitted if any of them has been transformed.
+  const PrimitiveBVH* bvh() const
+  {
+    return _bvh;
+  }
+
+  /// Returns the BVH of the turned on lights with finite range, built
+  /// by update(), or nullptr if there are no such lights. The BVH is
+  /// rebuilt only if any light of the scene has changed.
+  const LightBVH* lightBVH() const
+  {
+    return _lightBVH;
+  }
+
+  const auto& statistics() const
+  {
+    return _statistics;
+  }
+
 private:
+  using RayMask = PrimitiveBVH::RayMask;
+
+  // Side of the square tiles of pixels whose rays are traced as a
+  // single ray packet
+  static constexpr auto tileSize = 4;
+  // Side of the square tiles of pixels rendered as a task by one of
+  // the rendering threads (a multiple of tileSize)
+  static constexpr auto taskTileSize = 32;
+  // Side of the square blocks of pixels of the coarsest progressive
+  // rendering pass (taskTileSize must be a multiple of it)
+  static constexpr auto coarsestBlockSize = 8;
+
+  // Light inciding at a hit point: its incident vector, distance,
+  // and color at the point, and the cosine of the incident angle. The
+  // weight is used for sampling the lights
+  struct LightSample
+  {
+    const Light* light;
+    vec3f L;
+    float distance;
+    float NL;
+    Color color;
+    float weight{};
+
+  }; // LightSample
+
+  // Counters of a rendering thread, its stopwatch for timing the
+  // tracing phases, and its buffers for shading the hit points
+  struct alignas(64) TraceContext: Statistics::Counters
+  {
+    Stopwatch stopwatch;
+    std::vector<uint32_t> lightIds;
+    std::vector<LightSample> lightSamples;
+
+  }; // TraceContext
+
+  // Visible primitive of the BVH of the scene, and its transform
+  // stamp when the BVH was built or refitted
+  struct BVHEntry
+  {
+    const Primitive* primitive;
+    uint32_t transformStamp;
+
+  }; // BVHEntry
+
+  // Light of the scene, and the state of it that the light BVH
+  // depends on when the BVH was built
+  struct LightEntry
+  {
+    const Light* light;
+    Light::Type type;
+    uint32_t flags;
+    vec3f position;
+    float range;
+
+    bool operator ==(const LightEntry&) const = default;
+
+  }; // LightEntry
+
   Reference<PrimitiveBVH> _bvh;
+  std::vector<BVHEntry> _bvhEntries;
+  Reference<LightBVH> _lightBVH;
+  std::vector<LightEntry> _lightEntries;
+  // Turned on lights with infinite range
+  std::vector<const Light*> _infiniteLights;
   struct VRC
   {
     vec3f u;
@@ -89,21 +327,63 @@ private:
   } _vrc;
   float _minWeight;
   uint32_t _maxRecursionLevel;
-  uint64_t _numberOfRays;
-  uint64_t _numberOfHits;
+  uint32_t _maxSubdivisionLevel{};
+  float _colorThreshold{0.1f};
+  uint32_t _lightSampleCount{};
+  uint32_t _threadCount{};
+  // Whether the pixel colors are clamped to 1, which is not the case
+  // when rendering into an HDR image
+  bool _clampColors{true};
+  Statistics _statistics{};
   Ray3f _pixelRay;
   float _Vh;
   float _Vw;
   float _Ih;
   float _Iw;
+  // Camera parameters read by the rendering threads, which are copied
+  // by setView() since the camera can change while rendering
+  Camera::ProjectionType _projectionType;
+  float _nearPlane;
+  // Progressive rendering state
+  std::thread _renderThread;
+  std::atomic<bool> _rendering{};
+  std::atomic<bool> _canceled{};
+  std::atomic<uint32_t> _sampleCount{};
+  std::vector<Color> _sampleSums;
+  std::mutex _frameLock;
+  ImageBuffer _frame;
+  bool _frameChanged{};
 
+  void updateLights();
+  void setView(int width, int height);
   void scan(Image& image);
-  void setPixelRay(float x, float y);
-  Color shoot(float x, float y);
-  bool intersect(const Ray3f&, Intersection&);
-  Color trace(const Ray3f& ray, uint32_t level, float weight);
-  Color shade(const Ray3f&, Intersection&, uint32_t, float);
-  bool shadow(const Ray3f&);
+  void renderProgressive(uint32_t maxSamples);
+  void renderPass(int blockSize, uint32_t sample);
+
+  void setPixelRay(Ray3f&, float x, float y) const;
+  Color shoot(float x, float y, TraceContext&) const;
+  void shoot(int i, int j, int w, int h, Color*, TraceContext&) const;
+  void shootAdaptive(int i,
+    int j,
+    int w,
+    int h,
+    Color colors[][taskTileSize],
+    TraceContext&) const;
+  Color subdivide(float x,
+    float y,
+    float size,
+    const Color corners[4],
+    uint32_t level,
+    TraceContext&) const;
+  bool intersect(const Ray3f&, Intersection&, TraceContext&) const;
+  Color trace(const Ray3f&, uint32_t, float, TraceContext&) const;
+  Color shade(const Ray3f&,
+    Intersection&,
+    uint32_t,
+    float,
+    TraceContext&) const;
+  bool shadow(const Ray3f&, TraceContext&) const;
+  RayMask shadow(std::span<const Ray3f>, TraceContext&) const;
   Color background() const;
 
   vec3f imageToWindow(float x, float y) const
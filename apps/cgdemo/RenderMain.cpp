@@ -0,0 +1,354 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2026 Paulo Pagliosa.                              |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: RenderMain.cpp
+// ========
+// Main function for cg batch renderer, which ray traces a scene file
+// into an image file without any window or OpenGL context.
+//
+// Author: Paulo Pagliosa
+// Last revision: 17/10/2026
+
+#include "core/Exception.h"
+#include "graph/CameraProxy.h"
+#include "graphics/Application.h"
+#include "graphics/Assets.h"
+#include "graphics/GLGraphics3.h"
+#include "graphics/MemoryImage.h"
+#include "reader/SceneReader.h"
+#include "RayTracer.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+
+using namespace cg;
+
+namespace
+{ // begin namespace
+
+struct Options
+{
+  const char* sceneFile{};
+  const char* imageFile{};
+  const char* statsFile{};
+  const char* assetsPath{};
+  const char* cameraName{};
+  int width{1280};
+  int height{720};
+  int threadCount{};
+  int subdivisionLevel{};
+  int lightSampleCount{};
+  int benchCount{};
+  bool hdr{};
+
+}; // Options
+
+void
+usage()
+{
+  puts("Usage: cgrender [options] scene.scn\n"
+    "Options:\n"
+    "  -o, --output FILE    output image, whose format is given by the\n"
+    "                       extension: .ppm, .pfm, or .png (default:\n"
+    "                       scene name.ppm)\n"
+    "  -w, --width N        image width (default: 1280)\n"
+    "  -h, --height N       image height (default: 720)\n"
+    "  -t, --threads N      rendering threads (default: hardware threads)\n"
+    "  --camera NAME        scene object of the camera (default: the last\n"
+    "                       camera of the scene)\n"
+    "  --aa N               adaptive supersampling level (default: 0)\n"
+    "  --light-samples N    lights sampled per hit point, or 0 for all of\n"
+    "                       them (default: 0)\n"
+    "  --hdr                keep unclamped float colors (for .pfm output)\n"
+    "  --bench N            render N times and report timing percentiles\n"
+    "  --stats FILE         write the statistics of the last rendering\n"
+    "                       as JSON\n"
+    "  --assets PATH        assets directory (default: assets/ in the\n"
+    "                       directory of the executable)");
+}
+
+bool
+parseInt(const char* s, int& value, int min)
+{
+  char* end;
+  auto n = strtol(s, &end, 10);
+
+  if (end == s || *end != '\0' || n < min || n > INT_MAX)
+    return false;
+  value = int(n);
+  return true;
+}
+
+bool
+parseOptions(int argc, char** argv, Options& options)
+{
+  for (auto i = 1; i < argc; ++i)
+  {
+    auto arg = argv[i];
+
+    if (*arg != '-')
+    {
+      if (options.sceneFile != nullptr)
+        return false;
+      options.sceneFile = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--hdr"))
+    {
+      options.hdr = true;
+      continue;
+    }
+    if (i + 1 == argc)
+      return false;
+
+    auto value = argv[++i];
+    auto match = [arg](const char* shortName, const char* longName)
+    {
+      return (shortName && !strcmp(arg, shortName)) || !strcmp(arg, longName);
+    };
+
+    if (match("-o", "--output"))
+      options.imageFile = value;
+    else if (match("-w", "--width"))
+    {
+      if (!parseInt(value, options.width, 1))
+        return false;
+    }
+    else if (match("-h", "--height"))
+    {
+      if (!parseInt(value, options.height, 1))
+        return false;
+    }
+    else if (match("-t", "--threads"))
+    {
+      if (!parseInt(value, options.threadCount, 1))
+        return false;
+    }
+    else if (match(nullptr, "--camera"))
+      options.cameraName = value;
+    else if (match(nullptr, "--aa"))
+    {
+      if (!parseInt(value, options.subdivisionLevel, 0))
+        return false;
+    }
+    else if (match(nullptr, "--light-samples"))
+    {
+      if (!parseInt(value, options.lightSampleCount, 0))
+        return false;
+    }
+    else if (match(nullptr, "--bench"))
+    {
+      if (!parseInt(value, options.benchCount, 1))
+        return false;
+    }
+    else if (match(nullptr, "--stats"))
+      options.statsFile = value;
+    else if (match(nullptr, "--assets"))
+      options.assetsPath = value;
+    else
+      return false;
+  }
+  return options.sceneFile != nullptr;
+}
+
+Camera*
+findCamera(const graph::SceneObject& object, const char* name)
+{
+  if (!strcmp(object.name(), name))
+    for (auto component : object.components())
+      if (auto proxy = graph::asCamera(component))
+        return proxy->camera();
+  for (auto& child : object.children())
+    if (auto camera = findCamera(child, name))
+      return camera;
+  return nullptr;
+}
+
+// Returns the p-th percentile (nearest rank) of sorted values
+inline auto
+percentile(const std::vector<double>& values, int p)
+{
+  auto n = values.size();
+  auto k = (n * p + 99) / 100;
+
+  return values[k > 0 ? k - 1 : 0];
+}
+
+int
+render(const Options& options, const char* executable)
+{
+  namespace fs = std::filesystem;
+
+  if (options.assetsPath != nullptr)
+    Application::setAssetsPath(options.assetsPath);
+  else
+  {
+    auto basePath = fs::path{executable}.parent_path();
+
+    Application::setAssetsPath(basePath.empty() ?
+      "assets/" :
+      basePath.string() + "/assets/");
+  }
+  // The scenes saved by cgdemo can use its default meshes
+  Assets::initialize();
+
+  auto& meshes = Assets::meshes();
+
+  meshes["Box"] = GLGraphics3::box();
+  meshes["Sphere"] = GLGraphics3::sphere();
+  meshes["Cylinder"] = GLGraphics3::cylinder();
+  meshes["Cone"] = GLGraphics3::cone();
+  meshes["Plane"] = GLGraphics3::quad();
+
+  util::SceneReader reader;
+
+  // The reader errors are reported as in cgdemo
+  try
+  {
+    reader.setInput(options.sceneFile);
+    reader.execute();
+  }
+  catch (const std::exception& e)
+  {
+    puts(e.what());
+    return EXIT_FAILURE;
+  }
+
+  Reference<graph::Scene> scene = reader.scene();
+
+  if (scene == nullptr)
+    runtimeError("Unable to read scene '%s'", options.sceneFile);
+
+  auto camera = options.cameraName == nullptr ?
+    graph::CameraProxy::current() :
+    findCamera(*scene->root(), options.cameraName);
+
+  if (camera == nullptr)
+    runtimeError("Camera not found in scene '%s'", options.sceneFile);
+  camera->setAspectRatio(float(options.width) / float(options.height));
+
+  std::string imageFile;
+
+  if (options.imageFile != nullptr)
+    imageFile = options.imageFile;
+  else
+    imageFile = fs::path{options.sceneFile}.stem().string() + ".ppm";
+
+  Reference<ImageWriter> writer = ImageWriter::New(imageFile.c_str());
+
+  if (writer == nullptr)
+    runtimeError("Unknown format of image '%s'", imageFile.c_str());
+
+  Reference<RayTracer> rayTracer = new RayTracer{*scene, *camera};
+  Reference<MemoryImage> image = new MemoryImage{options.width,
+    options.height,
+    options.hdr};
+
+  rayTracer->setThreadCount(options.threadCount);
+  rayTracer->setMaxSubdivisionLevel(options.subdivisionLevel);
+  rayTracer->setLightSampleCount(options.lightSampleCount);
+
+  auto renderCount = math::max(options.benchCount, 1);
+  std::vector<double> times(renderCount);
+
+  // A single rendering streams the image rows to the file as they are
+  // completed; a benchmark writes the image after its renderings, thus
+  // its timings do not include any file I/O
+  if (options.benchCount == 0)
+  {
+    if (!writer->open(imageFile.c_str(), options.width, options.height))
+      runtimeError("Unable to write image '%s'", imageFile.c_str());
+    image->setWriter(*writer);
+  }
+  for (auto i = 0; i < renderCount; ++i)
+  {
+    rayTracer->renderImage(*image);
+    times[i] = rayTracer->statistics().renderTime;
+  }
+  if (!(options.benchCount == 0 ?
+    image->closeWriter() :
+    image->write(imageFile.c_str())))
+    runtimeError("Unable to write image '%s'", imageFile.c_str());
+  printf("\nImage written to '%s'\n", imageFile.c_str());
+
+  const auto& stats = rayTracer->statistics();
+
+  if (options.statsFile != nullptr)
+  {
+    auto file = fopen(options.statsFile, "w");
+
+    if (file == nullptr)
+      runtimeError("Unable to write statistics '%s'", options.statsFile);
+    stats.writeJSON(file);
+    fclose(file);
+  }
+  if (options.benchCount > 0)
+  {
+    auto mean = 0.0;
+
+    for (auto t : times)
+      mean += t;
+    mean /= renderCount;
+    std::sort(times.begin(), times.end());
+    printf("\nBenchmark: %d renderings of %dx%d pixels with %zu threads\n",
+      renderCount,
+      options.width,
+      options.height,
+      stats.threads.size());
+    printf("  min: %g ms\n", times.front());
+    printf("  p50: %g ms\n", percentile(times, 50));
+    printf("  p90: %g ms\n", percentile(times, 90));
+    printf("  p99: %g ms\n", percentile(times, 99));
+    printf("  max: %g ms\n", times.back());
+    printf("  mean: %g ms\n", mean);
+    printf("  rays per second (p50): %g\n",
+      stats.total.rays() * 1000 / percentile(times, 50));
+  }
+  return EXIT_SUCCESS;
+}
+
+} // end namespace
+
+int
+main(int argc, char** argv)
+{
+  Options options;
+
+  if (!parseOptions(argc, argv, options))
+  {
+    usage();
+    return EXIT_FAILURE;
+  }
+  try
+  {
+    return render(options, argv[0]);
+  }
+  catch (const std::exception& e)
+  {
+    printf("Error: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+}
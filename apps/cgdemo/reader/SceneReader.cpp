@@ -28,7 +28,7 @@
 // Source file for scene reader.
 //
 // Author: Paulo Pagliosa
-// Last revision: 11/07/2023
+// Last revision: 17/10/2026
 
 #include "SceneReader.h"
 
@@ -444,7 +444,11 @@ SceneReader::Parser::matchLight()
       case _RANGE:
         advance();
         if (auto range = matchFloat(); range >= 0)
+        {
+          // As in the light inspector, a zero range is infinite
           light->setRange(range);
+          light->flags.enable(Light::Infinite, range == 0);
+        }
         else
           error(INVALID_VALUE_FOR, "range");
         break;
@@ -0,0 +1,119 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2026 Paulo Pagliosa.                              |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: Parallel.h
+// ========
+// Utilities for simple data parallelism.
+//
+// Author: Paulo Pagliosa
+// Last revision: 17/10/2026
+
+#ifndef __Parallel_h
+#define __Parallel_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace cg
+{ // begin namespace cg
+
+/// Returns the number of hardware threads (at least 1).
+inline uint32_t
+hardwareThreadCount()
+{
+  return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+/// Calls f(i) for every i in [0, n) splitting the range into chunks
+/// of at least minChunkSize indices processed by concurrent threads.
+template <typename F>
+void
+parallelFor(uint32_t n, F&& f, uint32_t minChunkSize = 1024)
+{
+  auto nt = (n + minChunkSize - 1) / std::max(minChunkSize, 1u);
+
+  if ((nt = std::min(nt, hardwareThreadCount())) <= 1)
+  {
+    for (uint32_t i = 0; i < n; ++i)
+      f(i);
+    return;
+  }
+
+  auto chunkSize = (n + nt - 1) / nt;
+  auto run = [&f, n, chunkSize](uint32_t t)
+  {
+    for (auto i = t * chunkSize, e = std::min(i + chunkSize, n); i < e; ++i)
+      f(i);
+  };
+  std::vector<std::thread> threads;
+
+  threads.reserve(nt - 1);
+  for (uint32_t t = 1; t < nt; ++t)
+    threads.emplace_back(run, t);
+  run(0);
+  for (auto& thread : threads)
+    thread.join();
+}
+
+/// Calls f(i, t) for every i in [0, n) on threadCount concurrent
+/// threads, the calling one included, where t in [0, threadCount) is
+/// the index of the calling thread. Indices are handed out one at a
+/// time to threads as they become idle, which balances tasks of uneven
+/// costs.
+template <typename F>
+void
+parallelTasks(uint32_t n,
+  F&& f,
+  uint32_t threadCount = hardwareThreadCount())
+{
+  if ((threadCount = std::min(threadCount, n)) <= 1)
+  {
+    for (uint32_t i = 0; i < n; ++i)
+      f(i, 0u);
+    return;
+  }
+
+  std::atomic<uint32_t> next{0};
+  auto run = [&f, &next, n](uint32_t t)
+  {
+    for (uint32_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n;)
+      f(i, t);
+  };
+  std::vector<std::thread> threads;
+
+  threads.reserve(threadCount - 1);
+  for (uint32_t t = 1; t < threadCount; ++t)
+    threads.emplace_back(run, t);
+  run(0);
+  for (auto& thread : threads)
+    thread.join();
+}
+
+} // end namespace cg
+
+#endif // __Parallel_h
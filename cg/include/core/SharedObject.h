@@ -28,11 +28,12 @@
 // Class definition for shared object.
 //
 // Author: Paulo Pagliosa
-// Last revision: 14/07/2023
+// Last revision: 17/10/2026
 
 #ifndef __SharedObject_h
 #define __SharedObject_h
 
+#include <atomic>
 #include <concepts>
 
 namespace cg
@@ -69,7 +70,7 @@ public:
   /// Returns the number of references of this object.
   auto referenceCount() const
   {
-    return _referenceCount;
+    return _referenceCount.load(std::memory_order_relaxed);
   }
 
   template <typename T>
@@ -77,7 +78,7 @@ public:
   {
     ASSERT_SHARED(T, "Pointer to shared object expected");
     if (ptr != nullptr)
-      ++ptr->_referenceCount;
+      ptr->_referenceCount.fetch_add(1, std::memory_order_relaxed);
     return (T*)ptr;
   }
 
@@ -85,7 +86,8 @@ public:
   static void release(T* ptr)
   {
     ASSERT_SHARED(T, "Pointer to shared object expected");
-    if (ptr != nullptr && --ptr->_referenceCount <= 0)
+    if (ptr != nullptr &&
+      ptr->_referenceCount.fetch_sub(1, std::memory_order_acq_rel) <= 1)
       delete ptr;
   }
 
@@ -93,9 +95,24 @@ protected:
   /// Constructs an unreferenced object.
   SharedObject() = default;
 
+  /// Constructs an unreferenced copy of an object.
+  SharedObject(const SharedObject&):
+    SharedObject{}
+  {
+    // do nothing
+  }
+
+  /// Assigns nothing: the references of this object are kept.
+  SharedObject& operator =(const SharedObject&)
+  {
+    return *this;
+  }
+
 private:
-  mutable int _referenceCount{};
-  
+  // The references of an object can be taken and released by
+  // concurrent threads
+  mutable std::atomic<int> _referenceCount{};
+
 }; // SharedObject
 
 
@@ -28,17 +28,21 @@
 // Class definition for BVH.
 //
 // Author: Paulo Pagliosa
-// Last revision: 01/05/2024
+// Last revision: 17/10/2026
 
 #ifndef __BVH_h
 #define __BVH_h
 
 #include "core/SharedObject.h"
-#include "geometry/Bounds3.h"
+#include "geometry/Frustum.h"
 #include "geometry/Intersection.h"
+#include <algorithm>
 #include <functional>
 #include <cassert>
 #include <cinttypes>
+#include <cstdio>
+#include <limits>
+#include <span>
 #include <vector>
 
 namespace cg
@@ -55,23 +59,118 @@ public:
   class NodeView;
 
   using NodeFunction = std::function<void(const NodeView&)>;
-
-  ~BVHBase() override;
+  using RayMask = uint64_t;
+
+  /// Maximum number of rays of a packet query.
+  static constexpr uint32_t maxPacketSize = 64;
+
+  /// Split method used by the builder. SAH gives the best trees,
+  /// Median is faster to build, and Morton (LBVH) is the fastest
+  /// one, meant for very large inputs. SBVH extends SAH with spatial
+  /// splits, which clip primitives straddling a split plane, thus a
+  /// primitive can be referenced by several leaves; it gives better
+  /// trees than SAH for meshes with long, thin primitives, at the
+  /// cost of slower builds and more memory.
+  enum class SplitMethod
+  {
+    SAH,
+    Median,
+    Morton,
+    SBVH
+  };
 
   auto size() const
   {
-    return (size_t)_nodeCount;
+    return _nodes.size();
   }
 
   NodeView root() const;
   Bounds3f bounds() const;
   bool intersect(const Ray3f&) const;
   bool intersect(const Ray3f&, Intersection&) const;
+
+  /// Packet queries. Bit i of the returned mask is set if the i-th
+  /// ray hits a primitive, and the closest hit of the i-th ray is
+  /// stored into the i-th element of the intersection span. Rays
+  /// whose directions have the same signs (e.g., primary rays of a
+  /// 4x4 pixel tile) are traversed together, sharing a single node
+  /// stack; otherwise, or if the BVH is wide, and also below a node
+  /// hit by a single ray of the packet, rays are traversed one by one.
+  RayMask intersect(std::span<const Ray3f>) const;
+  RayMask intersect(std::span<const Ray3f>, std::span<Intersection>) const;
+
+  /// Result of a closest point query: the point of the primitives
+  /// closest to the query point, its coordinates in the primitive
+  /// (barycentric coordinates, for triangles), its distance to the
+  /// query point, and the id of the primitive, which is noPrimitive
+  /// if no primitive is within the maximum distance.
+  struct ClosestPoint
+  {
+    static constexpr auto noPrimitive = ~0u;
+
+    uint32_t primitiveId{noPrimitive};
+    vec3f point;
+    vec3f coordinates;
+    float distance;
+
+    explicit operator bool() const
+    {
+      return primitiveId != noPrimitive;
+    }
+
+  }; // ClosestPoint
+
+  /// Returns true if closest point queries are supported, i.e., if
+  /// the BVH can find the closest point of the primitives of a leaf.
+  virtual bool canFindClosestPoints() const;
+
+  /// Closest point queries. Nodes are visited in increasing order of
+  /// their distances to the query point (best-first), and the ones
+  /// farther than the closest point found so far are pruned. The
+  /// batch version processes the points in parallel. Both throw if
+  /// closest point queries are not supported.
+  ClosestPoint closestPoint(const vec3f&,
+    float maxDistance = math::Limits<float>::inf()) const;
+  void closestPoints(std::span<const vec3f>,
+    float maxDistance,
+    std::span<ClosestPoint>) const;
+
+  /// Overlap queries. The ids of the primitives of every leaf whose
+  /// bounds overlap the box or the frustum are written to the output
+  /// iterator, which is returned past the last id written. Subtrees
+  /// are pruned by their bounds and no memory is allocated. Primitives
+  /// are not tested themselves, and, with spatial splits, an id can
+  /// be written more than once.
+  template <typename OutputIt>
+  OutputIt query(const Bounds3f&, OutputIt) const;
+  template <typename OutputIt>
+  OutputIt query(const Frustumf&, OutputIt) const;
+
+  /// Pair of overlapping leaves of two BVHs, given by the ranges of
+  /// indices of their primitive ids (see primitiveId()).
+  struct LeafPair
+  {
+    uint32_t first1;
+    uint32_t count1;
+    uint32_t first2;
+    uint32_t count2;
+
+  }; // LeafPair
+
+  /// Finds the pairs of leaves of this BVH and another one whose
+  /// bounds overlap, where m transforms the other BVH into the space
+  /// of this one. The simultaneous traversal of both trees is split
+  /// into subtrees traversed in parallel, without allocating memory
+  /// but for the output. The self version finds every pair of leaves
+  /// of this BVH once, including each leaf paired with itself.
+  void overlap(const BVHBase&, const mat4f&, std::vector<LeafPair>&) const;
+  void selfOverlap(std::vector<LeafPair>&) const;
+
   void iterate(NodeFunction) const;
 
   auto empty() const
   {
-    return _nodeCount == 0;
+    return _nodes.empty();
   }
 
   auto primitiveId(int i) const
@@ -79,6 +178,124 @@ public:
     return _primitiveIds[i];
   }
 
+  /// Returns the number of primitives of the BVH. With spatial
+  /// splits, it can be less than the number of primitive references
+  /// of the leaves.
+  auto primitiveCount() const
+  {
+    return _primitiveCount;
+  }
+
+  auto maxPrimitivesPerNode() const
+  {
+    return _maxPrimitivesPerNode;
+  }
+
+  auto splitMethod() const
+  {
+    return _splitMethod;
+  }
+
+  /// Returns the number of children (2, 4, or 8) of the nodes
+  /// traversed by ray intersection queries.
+  auto width() const
+  {
+    return _width;
+  }
+
+  void setWidth(uint32_t);
+
+  /// Format of the wide nodes (width 4 or 8) traversed by ray queries.
+  /// Quantized formats keep the bounds of the children of a node in
+  /// 8 or 16 bits per coordinate, relative to the bounds of the node,
+  /// and decode them conservatively during traversal. They take about
+  /// 55% (8 bits) or 75% (16 bits) of the memory of full nodes of
+  /// width 8, and, since decoded bounds are looser, ray queries test
+  /// more nodes and primitives. Binary nodes, which are used by refits
+  /// and by other queries, are always kept in full precision.
+  enum class NodeFormat
+  {
+    Full,
+    Quantized16,
+    Quantized8
+  };
+
+  auto nodeFormat() const
+  {
+    return _nodeFormat;
+  }
+
+  void setNodeFormat(NodeFormat);
+
+  /// Returns the SAH cost of the BVH, i.e., the expected cost of a
+  /// ray query relative to the cost of a primitive intersection.
+  float sahCost() const;
+
+  /// Quality metrics of a BVH. Overlap is the sum over interior
+  /// nodes of the area of the intersection of their children bounds,
+  /// relative to the area of the root; averageOverlap is the mean of
+  /// that area relative to the area of the node. Histograms are
+  /// indexed by the depth of the leaves (root at 0) and by the number
+  /// of primitives of the leaves, respectively.
+  struct Statistics
+  {
+    uint32_t nodeCount;
+    uint32_t leafCount;
+    uint32_t primitiveCount;
+    uint32_t referenceCount;
+    uint32_t maxDepth;
+    float averageLeafDepth;
+    float sahCost;
+    float overlap;
+    float averageOverlap;
+    size_t nodeMemory; // bytes of binary and wide nodes
+    size_t indexMemory; // bytes of primitive ids
+    size_t leafDataMemory; // bytes of primitive data kept in leaf order
+    std::vector<uint32_t> depthHistogram;
+    std::vector<uint32_t> leafSizeHistogram;
+
+    void writeJSON(FILE* = stdout) const;
+
+  }; // Statistics
+
+  Statistics statistics() const;
+
+  /// Returns the number of bytes of the nodes, primitive ids, and
+  /// leaf data of the BVH.
+  size_t memorySize() const;
+
+  /// Counters of ray queries, which are updated only if BVH.cpp is
+  /// compiled with BVH_STATS defined. A box test of a ray packet or a
+  /// wide node counts as one test per ray or per child, respectively.
+  struct QueryCounters
+  {
+    uint64_t rays;
+    uint64_t nodesVisited;
+    uint64_t boxesTested;
+    uint64_t primitivesTested;
+
+    QueryCounters& operator +=(const QueryCounters&);
+
+    void writeJSON(FILE* = stdout) const;
+
+  }; // QueryCounters
+
+  /// Returns the query counters of the calling thread, accumulated
+  /// over all BVHs. They can be reset by assigning {} to them.
+  static QueryCounters& queryCounters();
+
+  /// Recomputes the bounds of the nodes bottom-up from the current
+  /// bounds of the primitives, keeping the topology of the tree. If
+  /// maxCostRatio is positive and the SAH cost of the refitted tree
+  /// is greater than maxCostRatio times its cost when built, the BVH
+  /// is rebuilt instead. Returns true if the BVH has been rebuilt.
+  virtual bool refit(float maxCostRatio = 0);
+
+  /// Writes the BVH to a file in a flat binary format: a header,
+  /// which includes the given key, followed by the nodes and the
+  /// primitive ids in their in-memory layout.
+  bool write(FILE*, uint64_t key) const;
+
 protected:
   class PrimitiveInfo;
 
@@ -87,88 +304,379 @@ protected:
 
   IndexArray _primitiveIds;
 
-  BVHBase(uint32_t maxPrimitivesPerNode):
-    _maxPrimitivesPerNode{maxPrimitivesPerNode}
+  BVHBase(uint32_t maxPrimitivesPerNode, SplitMethod splitMethod):
+    _maxPrimitivesPerNode{maxPrimitivesPerNode},
+    _splitMethod{splitMethod}
   {
     // do nothing
   }
 
-  void build(PrimitiveInfoArray& primitiveInfo)
-  {
-    auto np = (uint32_t)primitiveInfo.size();
-    IndexArray orderedPrimitiveIds(np);
+  void build(PrimitiveInfoArray&);
+  void rebuild();
+
+  // Reads a BVH written by write(). Returns false if the file is
+  // corrupt, or its key, build parameters, or number of primitives
+  // do not match the given ones
+  bool read(FILE*, uint64_t key, uint32_t primitiveCount);
+
+  static uint64_t hash(const void*, size_t, uint64_t = 14695981039346656037ull);
+
+  virtual Bounds3f primitiveBounds(uint32_t) const = 0;
 
-    _root = makeNode(primitiveInfo, 0, np, orderedPrimitiveIds);
-    _primitiveIds.swap(orderedPrimitiveIds);
+  // Returns the size of the copies of primitive data that derived
+  // classes may keep in leaf order
+  virtual size_t leafDataMemory() const
+  {
+    return 0;
   }
 
+  // Computes the bounds of the parts of a primitive on each side of
+  // the plane x[dim] = position, which crosses the primitive bounds.
+  // Used by SBVH builds; by default, the primitive bounds are split
+  virtual void splitPrimitive(uint32_t id,
+    int dim,
+    float position,
+    Bounds3f& left,
+    Bounds3f& right) const;
+
   virtual bool intersectLeaf(uint32_t, uint32_t, const Ray3f&) const = 0;
   virtual void intersectLeaf(uint32_t,
     uint32_t,
     const Ray3f&,
     Intersection&) const = 0;
 
+  // Updates the closest point to a point with the primitives of a
+  // leaf closer to it than the current closest point. Called only if
+  // canFindClosestPoints() is true
+  virtual void closestPointLeaf(uint32_t,
+    uint32_t,
+    const vec3f&,
+    ClosestPoint&) const;
+
+  // Packet versions of the leaf intersection tests, which are called
+  // with a mask of the active rays of the packet. By default, they
+  // call the ray versions above for every active ray
+  virtual RayMask intersectLeaf(uint32_t,
+    uint32_t,
+    const Ray3f*,
+    RayMask) const;
+  virtual void intersectLeaf(uint32_t,
+    uint32_t,
+    const Ray3f*,
+    RayMask,
+    Intersection*) const;
+
 private:
   class NodeRay;
+  class RayPacket;
   class Node;
-
-  Node* _root{};
-  uint32_t _nodeCount{};
+  class Builder;
+  template <int N> class WideNode;
+  template <int N, typename Q> class QuantizedNode;
+
+  using NodeArray = std::vector<Node>;
+  template <int N> using WideNodeArray = std::vector<WideNode<N>>;
+  template <int N, typename Q>
+  using QuantizedNodeArray = std::vector<QuantizedNode<N, Q>>;
+
+  // Maximum depth of a BVH, which is also the size of the stack of
+  // nodes postponed during a traversal
+  static constexpr uint32_t maxDepth = 64;
+
+  NodeArray _nodes;
+  WideNodeArray<4> _wideNodes4;
+  WideNodeArray<8> _wideNodes8;
+  QuantizedNodeArray<4, uint8_t> _wideNodes4Q8;
+  QuantizedNodeArray<4, uint16_t> _wideNodes4Q16;
+  QuantizedNodeArray<8, uint8_t> _wideNodes8Q8;
+  QuantizedNodeArray<8, uint16_t> _wideNodes8Q16;
   uint32_t _maxPrimitivesPerNode;
-
-  Node* makeNode(PrimitiveInfoArray&, uint32_t, uint32_t, IndexArray&);
-  Node* makeLeaf(PrimitiveInfoArray&, uint32_t, uint32_t, IndexArray&);
+  SplitMethod _splitMethod;
+  uint32_t _primitiveCount{};
+  uint32_t _width{2};
+  NodeFormat _nodeFormat{NodeFormat::Full};
+  float _buildCost{};
+
+  void makeWideNodes();
+  template <int N>
+  void makeWideNodes(WideNodeArray<N>&,
+    QuantizedNodeArray<N, uint8_t>&,
+    QuantizedNodeArray<N, uint16_t>&);
+  size_t nodeMemory() const;
+
+  template <typename Overlaps, typename OutputIt>
+  OutputIt queryNodes(Overlaps, OutputIt) const;
+
+  void findLeafPairs(const BVHBase&,
+    const mat4f&,
+    bool,
+    std::vector<LeafPair>&) const;
+
+  bool traverse(const Node*, const NodeRay&) const;
+  void traverse(const Node*, NodeRay&, Intersection&) const;
+
+  template <int N>
+  uint32_t collapse(WideNodeArray<N>&, const Node*) const;
+  template <int N, typename Q>
+  static void quantize(const WideNodeArray<N>&, QuantizedNodeArray<N, Q>&);
+
+  bool intersectWide(const Ray3f&) const;
+  bool intersectWide(const Ray3f&, Intersection&) const;
+  template <typename T>
+  bool intersectWide(const std::vector<T>&, const Ray3f&) const;
+  template <typename T>
+  bool intersectWide(const std::vector<T>&,
+    const Ray3f&,
+    Intersection&) const;
 
   friend NodeView;
 
 }; // BVHBase
 
+// Nodes are stored in depth-first order in a single array: the first
+// child of an interior node immediately follows it, and the second one
+// is at a given offset from it
 class BVHBase::Node
 {
 public:
-  ~Node()
-  {
-    delete _children[0];
-    delete _children[1];
-  }
+  Node() = default;
 
 private:
   Bounds3f _bounds;
-  Node* _children[2];
-  uint32_t _first;
-  uint32_t _count;
+  uint32_t _offset; // first primitive (leaf) or second child offset
+  uint32_t _count: 30; // number of primitives (leaf) or zero
+  uint32_t _axis: 2; // split axis (interior)
 
-  Node(const Bounds3f& bounds, uint32_t first, uint32_t count):
-    _bounds{bounds},
-    _first{first},
-    _count{count}
+  void setLeaf(const Bounds3f& bounds, uint32_t first, uint32_t count)
   {
-    _children[0] = _children[1] = nullptr;
+    assert(count < (1u << 30));
+    _bounds = bounds;
+    _offset = first;
+    _count = count;
+    _axis = 0;
   }
 
-  Node(Node* c0, Node* c1):
-    _count{}
+  void setInterior(uint32_t secondChildOffset, int axis)
   {
-    _bounds.inflate(c0->_bounds);
-    _bounds.inflate(c1->_bounds);
-    _children[0] = c0;
-    _children[1] = c1;
+    _bounds = this[1]._bounds;
+    _bounds.inflate(this[secondChildOffset]._bounds);
+    _offset = secondChildOffset;
+    _count = 0;
+    _axis = axis;
   }
 
   bool isLeaf() const
   {
-    return _children[0] == nullptr;
+    return _count > 0;
   }
 
-  bool intersect(const NodeRay&) const;
+  const Node* child(int i) const
+  {
+    return this + (i == 0 ? 1 : _offset);
+  }
 
-  static void iterate(const Node*, NodeFunction);
+  bool intersect(const Ray3f&, const vec3f&, const int*) const;
+  bool intersect(const NodeRay&) const;
 
   friend BVHBase;
+  friend Builder;
   friend NodeView;
 
 }; // BVHBase::Node
 
+template <typename Overlaps, typename OutputIt>
+OutputIt
+BVHBase::queryNodes(Overlaps overlaps, OutputIt out) const
+{
+  if (_nodes.empty())
+    return out;
+
+  const Node* stack[maxDepth];
+  uint32_t top{};
+
+  for (auto node = _nodes.data();;)
+  {
+    if (overlaps(node->_bounds))
+    {
+      if (node->isLeaf())
+      {
+        auto i = _primitiveIds.begin() + node->_offset;
+
+        out = std::copy(i, i + node->_count, out);
+      }
+      else
+      {
+        stack[top++] = node->child(1);
+        node = node->child(0);
+        continue;
+      }
+    }
+    if (top == 0)
+      return out;
+    node = stack[--top];
+  }
+}
+
+template <typename OutputIt>
+inline OutputIt
+BVHBase::query(const Bounds3f& bounds, OutputIt out) const
+{
+  return queryNodes([&bounds](const Bounds3f& b)
+  {
+    return bounds.intersect(b);
+  }, out);
+}
+
+template <typename OutputIt>
+inline OutputIt
+BVHBase::query(const Frustumf& frustum, OutputIt out) const
+{
+  return queryNodes([&frustum](const Bounds3f& b)
+  {
+    return frustum.intersect(b);
+  }, out);
+}
+
+// Wide nodes are built by collapsing the binary tree and keep the
+// bounds of their N children in SoA layout, so that the children can
+// be tested against a ray all at once. Leaves are not stored as nodes,
+// but as children with a nonzero primitive count
+template <int N>
+class alignas(64) BVHBase::WideNode
+{
+public:
+  static constexpr auto width = N;
+
+  using Bounds = float[6][N];
+
+  WideNode()
+  {
+    // Unused children have empty bounds and are never hit
+    for (int i = 0; i < N; ++i)
+      setChild(i, Bounds3f{}, 0, 0);
+  }
+
+private:
+  Bounds _bounds; // min x, y, z and max x, y, z of the children
+  uint32_t _offset[N]; // first primitive (leaf) or wide node index
+  uint32_t _count[N]; // number of primitives (leaf) or zero
+
+  const Bounds& childBounds(Bounds&) const
+  {
+    return _bounds;
+  }
+
+  static constexpr uint32_t childMask()
+  {
+    return ~0u;
+  }
+
+  void setChild(int i, const Bounds3f& b, uint32_t offset, uint32_t count)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      _bounds[k][i] = b.min()[k];
+      _bounds[k + 3][i] = b.max()[k];
+    }
+    _offset[i] = offset;
+    _count[i] = count;
+  }
+
+  friend BVHBase;
+
+}; // BVHBase::WideNode
+
+// Quantized wide nodes keep the bounds of their children as integers
+// relative to the bounds of the node. A coordinate q along an axis is
+// decoded as origin + q * scale, where the scale is a power of two, so
+// that q * scale is exact and decoding rounds only once, with or
+// without fused multiply-adds. Coordinates are rounded outwards when
+// encoded, hence decoded bounds always enclose the actual ones
+template <int N, typename Q>
+class alignas(16) BVHBase::QuantizedNode
+{
+public:
+  static constexpr auto width = N;
+
+  using Bounds = float[6][N];
+
+  explicit QuantizedNode(const Bounds3f& bounds)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      auto min = bounds.min()[k];
+      auto max = bounds.max()[k];
+      int e;
+
+      // Smallest power of two such that qMax * scale >= max - min
+      if (std::frexp((max - min) / qMax, &e) == 0.5f)
+        --e;
+      _origin[k] = min;
+      _scale[k] = std::max(std::ldexp(1.0f, e),
+        std::numeric_limits<float>::min());
+      while (decode(k, qMax) < max)
+        _scale[k] *= 2;
+    }
+    for (int i = 0; i < N; ++i)
+    {
+      for (int k = 0; k < 3; ++k)
+      {
+        _bounds[k][i] = qMax;
+        _bounds[k + 3][i] = 0;
+      }
+      _offset[i] = _count[i] = 0;
+    }
+    _childCount = 0;
+  }
+
+private:
+  static constexpr uint32_t qMax = std::numeric_limits<Q>::max();
+
+  float _origin[3];
+  float _scale[3];
+  Q _bounds[6][N]; // min x, y, z and max x, y, z of the children
+  uint32_t _offset[N]; // first primitive (leaf) or wide node index
+  uint32_t _count[N]; // number of primitives (leaf) or zero
+  uint8_t _childCount;
+
+  float decode(int k, uint32_t q) const
+  {
+    return _origin[k] + float(q) * _scale[k];
+  }
+
+  // Children must be set in order, and be inside the node bounds
+  void setChild(int i, const Bounds3f& b, uint32_t offset, uint32_t count)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      auto x = (b.min()[k] - _origin[k]) / _scale[k];
+      auto q = uint32_t(std::clamp(std::floor(x), 0.0f, float(qMax)));
+
+      while (q > 0 && decode(k, q) > b.min()[k])
+        --q;
+      _bounds[k][i] = Q(q);
+      x = (b.max()[k] - _origin[k]) / _scale[k];
+      q = uint32_t(std::clamp(std::ceil(x), 0.0f, float(qMax)));
+      while (q < qMax && decode(k, q) < b.max()[k])
+        ++q;
+      _bounds[k + 3][i] = Q(q);
+    }
+    _offset[i] = offset;
+    _count[i] = count;
+    _childCount = uint8_t(i + 1);
+  }
+
+  const Bounds& childBounds(Bounds&) const;
+
+  uint32_t childMask() const
+  {
+    return (1u << _childCount) - 1;
+  }
+
+  friend BVHBase;
+
+}; // BVHBase::QuantizedNode
+
 class BVHBase::NodeView
 {
 public:
@@ -186,12 +694,12 @@ public:
   {
     assert(!isLeaf());
     assert(i == 0 || i == 1);
-    return NodeView{_node->_children[i]};
+    return NodeView{_node->child(i)};
   }
 
   auto first() const
   {
-    return _node->_first;
+    return _node->_offset;
   }
 
   auto count() const
@@ -239,7 +747,7 @@ public:
 inline BVHBase::NodeView
 BVHBase::root() const
 {
-  return _root;
+  return _nodes.empty() ? nullptr : _nodes.data();
 }
 
 
@@ -253,7 +761,7 @@ class BVH final: public BVHBase
 public:
   using PrimitiveArray = std::vector<Reference<T>>;
 
-  BVH(PrimitiveArray&&, uint32_t = 8);
+  BVH(PrimitiveArray&&, uint32_t = 8, SplitMethod = SplitMethod::Median);
 
   auto& primitives() const
   {
@@ -263,6 +771,9 @@ public:
 private:
   PrimitiveArray _primitives;
 
+  using BVHBase::intersectLeaf;
+
+  Bounds3f primitiveBounds(uint32_t) const override;
   bool intersectLeaf(uint32_t, uint32_t, const Ray3f&) const override;
   void intersectLeaf(uint32_t,
     uint32_t,
@@ -272,8 +783,10 @@ private:
 }; // BVH
 
 template <typename T>
-BVH<T>::BVH(PrimitiveArray&& primitives, uint32_t maxPrimitivesPerNode):
-  BVHBase{maxPrimitivesPerNode},
+BVH<T>::BVH(PrimitiveArray&& primitives,
+  uint32_t maxPrimitivesPerNode,
+  SplitMethod splitMethod):
+  BVHBase{maxPrimitivesPerNode, splitMethod},
   _primitives{std::move(primitives)}
 {
   auto np = (uint32_t)_primitives.size();
@@ -284,10 +797,17 @@ BVH<T>::BVH(PrimitiveArray&& primitives, uint32_t maxPrimitivesPerNode):
   PrimitiveInfoArray primitiveInfo(np);
 
   for (uint32_t i = 0; i < np; ++i)
-    primitiveInfo[i] = {_primitiveIds[i] = i, _primitives[i]->bounds()};
+    primitiveInfo[i] = {_primitiveIds[i] = i, primitiveBounds(i)};
   build(primitiveInfo);
 }
 
+template <typename T>
+inline Bounds3f
+BVH<T>::primitiveBounds(uint32_t i) const
+{
+  return _primitives[i]->bounds();
+}
+
 template <typename T>
 bool
 BVH<T>::intersectLeaf(uint32_t first, uint32_t count, const Ray3f& ray) const
@@ -28,7 +28,7 @@
 // Class definition for 3D axis-aligned bounding box.
 //
 // Author: Paulo Pagliosa
-// Last revision: 28/01/2020
+// Last revision: 17/10/2026
 
 #ifndef __Bounds3_h
 #define __Bounds3_h
@@ -240,6 +240,15 @@ public:
     return true;
   }
 
+  /// Returns true if this object and b overlap (touching counts).
+  HOST DEVICE
+  bool intersect(const Bounds<real, 3>& b) const
+  {
+    return _p1.x <= b._p2.x && b._p1.x <= _p2.x &&
+      _p1.y <= b._p2.y && b._p1.y <= _p2.y &&
+      _p1.z <= b._p2.z && b._p1.z <= _p2.z;
+  }
+
   HOST DEVICE
   bool intersect(const Ray3<real>& ray, real& tMin, real& tMax) const
   {
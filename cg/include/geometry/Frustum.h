@@ -0,0 +1,125 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2026 Paulo Pagliosa.                              |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: Frustum.h
+// ========
+// Class definition for view frustum.
+//
+// Author: Paulo Pagliosa
+// Last revision: 17/10/2026
+
+#ifndef __Frustum_h
+#define __Frustum_h
+
+#include "geometry/Bounds3.h"
+#include "math/Vector4.h"
+
+namespace cg
+{ // begin namespace cg
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// Frustum: view frustum class
+// =======
+template <typename real>
+class Frustum
+{
+public:
+  ASSERT_REAL(real, "Frustum: floating point type expected");
+
+  using vec3 = Vector3<real>;
+  using vec4 = Vector4<real>;
+  using mat4 = Matrix4x4<real>;
+
+  /// Constructs a Frustum object from a view-projection matrix, e.g.,
+  /// the product of the projection and world to camera matrices of a
+  /// camera. The clip volume of the matrix is the one of OpenGL.
+  HOST DEVICE
+  explicit Frustum(const mat4& m)
+  {
+    set(m);
+  }
+
+  HOST DEVICE
+  void set(const mat4& m)
+  {
+    // Planes are extracted from the rows of m (Gribb-Hartmann)
+    for (int i = 0; i < 3; ++i)
+      for (int j = 0; j < 4; ++j)
+      {
+        _planes[2 * i][j] = m(3, j) + m(i, j);
+        _planes[2 * i + 1][j] = m(3, j) - m(i, j);
+      }
+  }
+
+  /// Returns the i-th plane (left, right, bottom, top, near, and
+  /// far) of this object, as (a, b, c, d) such that the inner side
+  /// is a * x + b * y + c * z + d >= 0. Planes are not normalized.
+  HOST DEVICE
+  const vec4& plane(int i) const
+  {
+    return _planes[i];
+  }
+
+  HOST DEVICE
+  bool contains(const vec3& p) const
+  {
+    for (const auto& e : _planes)
+      if (e.x * p.x + e.y * p.y + e.z * p.z + e.w < 0)
+        return false;
+    return true;
+  }
+
+  /// Returns false if the box b is outside of this object. The test
+  /// is conservative: a box outside of the frustum, but not entirely
+  /// on the outer side of any plane, is reported as intersecting it.
+  HOST DEVICE
+  bool intersect(const Bounds3<real>& b) const
+  {
+    for (const auto& e : _planes)
+    {
+      // Corner of b farthest along the normal of the plane
+      auto x = e.x < 0 ? b.min().x : b.max().x;
+      auto y = e.y < 0 ? b.min().y : b.max().y;
+      auto z = e.z < 0 ? b.min().z : b.max().z;
+
+      if (e.x * x + e.y * y + e.z * z + e.w < 0)
+        return false;
+    }
+    return true;
+  }
+
+private:
+  vec4 _planes[6];
+
+}; // Frustum
+
+using Frustumf = Frustum<float>;
+using Frustumd = Frustum<double>;
+
+} // end namespace cg
+
+#endif // __Frustum_h
@@ -28,7 +28,7 @@
 // Class definition for triangle functions.
 //
 // Author: Paulo Pagliosa
-// Last revision: 01/09/2023
+// Last revision: 17/10/2026
 
 #ifndef __Triangle_h
 #define __Triangle_h
@@ -111,17 +111,16 @@ interpolate(const vec3& b, const T t[3])
   return interpolate(b, t[0], t[1], t[2]);
 }
 
+// Intersects a ray with the triangle (p0, p0 + e1, p0 + e2)
 template <typename real>
 HOST DEVICE inline bool
-intersect(const Ray3<real>& ray,
+intersectEdges(const Ray3<real>& ray,
   const Vector3<real>& p0,
-  const Vector3<real>& p1,
-  const Vector3<real>& p2,
+  const Vector3<real>& e1,
+  const Vector3<real>& e2,
   Vector3<real>& b,
   real& t)
 {
-  auto e1 = p1 - p0;
-  auto e2 = p2 - p0;
   auto s1 = ray.direction.cross(e2);
   auto invDet = s1.dot(e1);
 
@@ -150,6 +149,146 @@ intersect(const Ray3<real>& ray,
   return true;
 }
 
+template <typename real>
+HOST DEVICE inline bool
+intersect(const Ray3<real>& ray,
+  const Vector3<real>& p0,
+  const Vector3<real>& p1,
+  const Vector3<real>& p2,
+  Vector3<real>& b,
+  real& t)
+{
+  return intersectEdges(ray, p0, p1 - p0, p2 - p0, b, t);
+}
+
+// Returns the point of the triangle (p0, p1, p2) closest to p, and
+// its barycentric coordinates b, by finding the Voronoi region of the
+// triangle (vertex, edge, or face) that contains p
+template <typename real>
+HOST DEVICE inline Vector3<real>
+closestPoint(const Vector3<real>& p,
+  const Vector3<real>& p0,
+  const Vector3<real>& p1,
+  const Vector3<real>& p2,
+  Vector3<real>& b)
+{
+  auto e1 = p1 - p0;
+  auto e2 = p2 - p0;
+  auto v0 = p - p0;
+  auto d1 = e1.dot(v0);
+  auto d2 = e2.dot(v0);
+
+  if (d1 <= 0 && d2 <= 0)
+  {
+    b.set(1, 0, 0);
+    return p0;
+  }
+
+  auto v1 = p - p1;
+  auto d3 = e1.dot(v1);
+  auto d4 = e2.dot(v1);
+
+  if (d3 >= 0 && d4 <= d3)
+  {
+    b.set(0, 1, 0);
+    return p1;
+  }
+
+  auto c2 = d1 * d4 - d3 * d2;
+
+  if (c2 <= 0 && d1 >= 0 && d3 <= 0)
+  {
+    auto s = d1 / (d1 - d3);
+
+    b.set(1 - s, s, 0);
+    return p0 + e1 * s;
+  }
+
+  auto v2 = p - p2;
+  auto d5 = e1.dot(v2);
+  auto d6 = e2.dot(v2);
+
+  if (d6 >= 0 && d5 <= d6)
+  {
+    b.set(0, 0, 1);
+    return p2;
+  }
+
+  auto c1 = d5 * d2 - d1 * d6;
+
+  if (c1 <= 0 && d2 >= 0 && d6 <= 0)
+  {
+    auto s = d2 / (d2 - d6);
+
+    b.set(1 - s, 0, s);
+    return p0 + e2 * s;
+  }
+
+  auto c0 = d3 * d6 - d5 * d4;
+
+  if (c0 <= 0 && d4 >= d3 && d5 >= d6)
+  {
+    auto s = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+
+    b.set(0, 1 - s, s);
+    return p1 + (p2 - p1) * s;
+  }
+
+  // p projects inside the triangle
+  auto invSum = 1 / (c0 + c1 + c2);
+  auto s = c1 * invSum;
+  auto t = c2 * invSum;
+
+  b.set(1 - s - t, s, t);
+  return p0 + e1 * s + e2 * t;
+}
+
+// Returns true if the triangles (p0, p1, p2) and (q0, q1, q2) overlap
+// (touching counts). The triangles are separated if so are their
+// projections onto one of the axes: the normals of the triangles, the
+// cross products of their edges, and, to handle coplanar triangles,
+// the normals of their edges in their planes
+template <typename real>
+HOST DEVICE inline bool
+overlap(const Vector3<real>& p0,
+  const Vector3<real>& p1,
+  const Vector3<real>& p2,
+  const Vector3<real>& q0,
+  const Vector3<real>& q1,
+  const Vector3<real>& q2)
+{
+  const Vector3<real> e[]{p1 - p0, p2 - p1, p0 - p2};
+  const Vector3<real> f[]{q1 - q0, q2 - q1, q0 - q2};
+  auto separates = [&](const Vector3<real>& axis)
+  {
+    auto a = axis.dot(p0);
+    auto b = axis.dot(p1);
+    auto c = axis.dot(p2);
+    auto pMin = math::min(a, math::min(b, c));
+    auto pMax = math::max(a, math::max(b, c));
+
+    a = axis.dot(q0);
+    b = axis.dot(q1);
+    c = axis.dot(q2);
+    return pMax < math::min(a, math::min(b, c)) ||
+      pMin > math::max(a, math::max(b, c));
+  };
+  auto n = e[0].cross(e[1]);
+  auto m = f[0].cross(f[1]);
+
+  if (separates(n) || separates(m))
+    return false;
+  for (int i = 0; i < 3; ++i)
+  {
+    for (int j = 0; j < 3; ++j)
+      if (separates(e[i].cross(f[j])))
+        return false;
+    if (separates(n.cross(e[i])) || separates(m.cross(f[i])))
+      return false;
+  }
+  return true;
+}
+
 } // end namespace triangle
 
 } // end namespace cg
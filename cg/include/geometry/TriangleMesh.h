@@ -28,7 +28,7 @@
 // Class definition for simple triangle mesh.
 //
 // Author: Paulo Pagliosa
-// Last revision: 16/08/2022
+// Last revision: 17/10/2026
 
 #ifndef __TriangleMesh_h
 #define __TriangleMesh_h
@@ -101,6 +101,17 @@ public:
   void TRS(const mat4f& trs);
   void normalize();
 
+  /// Must be invoked after the vertices of the mesh are modified
+  /// in place (e.g., by a deformation), so that its bounds and BVH
+  /// are updated.
+  void verticesChanged();
+
+  /// Returns a stamp that changes whenever the vertices change.
+  auto vertexStamp() const
+  {
+    return _vertexStamp;
+  }
+
   const Data& data() const
   {
     return _data;
@@ -121,6 +132,7 @@ public:
 private:
   Data _data;
   mutable Bounds3f _bounds;
+  uint32_t _vertexStamp{};
 
 }; // TriangleMesh
 
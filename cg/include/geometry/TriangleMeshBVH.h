@@ -28,13 +28,15 @@
 // Class definition for triangle mesh BVH.
 //
 // Author: Paulo Pagliosa
-// Last revision: 21/01/2022
+// Last revision: 17/10/2026
 
 #ifndef __TriangleMeshBVH_h
 #define __TriangleMeshBVH_h
 
 #include "geometry/BVH.h"
 #include "geometry/TriangleMesh.h"
+#include <atomic>
+#include <mutex>
 
 namespace cg
 { // begin namespace cg
@@ -47,21 +49,171 @@ namespace cg
 class TriangleMeshBVH final: public BVHBase
 {
 public:
-  TriangleMeshBVH(const TriangleMesh&, uint32_t = 64);
+  TriangleMeshBVH(const TriangleMesh&,
+    uint32_t = 64,
+    SplitMethod = SplitMethod::SAH);
 
   const TriangleMesh* mesh() const
   {
     return _mesh;
   }
 
+  /// Returns true if the vertices of the mesh have changed since
+  /// the BVH was built or refitted.
+  bool isStale() const
+  {
+    return _vertexStamp.load(std::memory_order_acquire) !=
+      _mesh->vertexStamp();
+  }
+
+  bool refit(float maxCostRatio = 0) override;
+
+  bool canFindClosestPoints() const override;
+
+  /// Refits the BVH if it is stale. Concurrent calls are serialized,
+  /// thus a BVH shared by several threads is refitted once, but it
+  /// must not be queried while being refitted. Returns true if the
+  /// BVH has been refitted.
+  bool refitIfStale(float maxCostRatio = 0);
+
+  /// Returns true if the BVH keeps a copy of its triangles in leaf
+  /// order, as a vertex and two edges each, so that leaf tests read
+  /// contiguous memory instead of the mesh triangles and vertices.
+  bool hasLeafTriangles() const
+  {
+    return !_leafTriangles.empty();
+  }
+
+  /// Creates or frees the copy of the triangles in leaf order, which
+  /// takes leafDataMemory() bytes (36 per triangle reference) and is
+  /// updated by refit().
+  void setLeafTriangles(bool);
+
+  /// Returns the number of triangles tested at once against a ray by
+  /// the SIMD leaf tests of the build: 8 with AVX2, 4 with SSE, or 1
+  /// if the build has no SIMD tests (e.g., BVH_NO_SIMD is defined).
+  static uint32_t triangleBlockSize();
+
+  /// Returns true if the leaf tests of the BVH use the SIMD tests of
+  /// the build. By default, they do not: the scalar tests are as fast
+  /// for the few triangles of the leaves of SAH builds (see cgbench),
+  /// and the SIMD ones can differ from them in the last bits.
+  bool triangleBlocks() const
+  {
+    return _triangleBlocks;
+  }
+
+  /// Enables or disables the SIMD leaf tests, e.g., for BVHs with
+  /// large leaves or for comparing them with the scalar ones. Must not
+  /// be called while the BVH is queried.
+  void setTriangleBlocks(bool enabled)
+  {
+    _triangleBlocks = enabled;
+  }
+
+  size_t leafDataMemory() const override
+  {
+    return _leafTriangles.size() * sizeof(LeafTriangle);
+  }
+
+  /// Returns the key of a BVH file, which is a hash of the vertices
+  /// and triangles of the mesh and of the build parameters.
+  static uint64_t fileKey(const TriangleMesh&, uint32_t, SplitMethod);
+
+  /// Loads the BVH of a mesh from a file written by save(). Returns
+  /// null if the file cannot be opened, or if it is corrupt or stale,
+  /// i.e., it was not written for the mesh and build parameters.
+  static TriangleMeshBVH* load(const char*,
+    const TriangleMesh&,
+    uint32_t = 64,
+    SplitMethod = SplitMethod::SAH);
+
+  bool save(const char*) const;
+
+  /// Pair of indices of triangles of two meshes.
+  struct TrianglePair
+  {
+    uint32_t first;
+    uint32_t second;
+
+  }; // TrianglePair
+
+  using BVHBase::overlap;
+  using BVHBase::selfOverlap;
+
+  /// Finds the pairs of triangles of the overlapping leaves of this
+  /// BVH and another one, where m transforms the mesh of the other
+  /// BVH into the space of the mesh of this one. If exact is true,
+  /// only the pairs of triangles that intersect are kept. The self
+  /// version finds pairs of triangles of the mesh of this BVH, with
+  /// first < second, and skips the ones sharing a vertex. The pairs
+  /// are sorted and unique.
+  void overlap(const TriangleMeshBVH&,
+    const mat4f&,
+    std::vector<TrianglePair>&,
+    bool exact = true) const;
+  void selfOverlap(std::vector<TrianglePair>&, bool exact = true) const;
+
 private:
+  struct LeafTriangle
+  {
+    vec3f p0;
+    vec3f e1; // p1 - p0
+    vec3f e2; // p2 - p0
+
+  }; // LeafTriangle
+
   Reference<TriangleMesh> _mesh;
+  std::atomic<uint32_t> _vertexStamp;
+  std::mutex _refitLock;
+  std::vector<LeafTriangle> _leafTriangles;
+  bool _triangleBlocks{false};
+
+  TriangleMeshBVH(const TriangleMesh&, uint32_t, SplitMethod, bool);
+
+  LeafTriangle meshTriangle(uint32_t) const;
+
+  // Returns the triangle referenced by the i-th primitive id
+  LeafTriangle leafTriangle(uint32_t i) const
+  {
+    if (!_leafTriangles.empty())
+      return _leafTriangles[i];
+    return meshTriangle(_primitiveIds[i]);
+  }
+
+  void makeLeafTriangles();
+
+  void findTrianglePairs(const TriangleMeshBVH&,
+    const mat4f&,
+    bool,
+    bool,
+    std::vector<TrianglePair>&) const;
+
+  Bounds3f primitiveBounds(uint32_t) const override;
+  void splitPrimitive(uint32_t,
+    int,
+    float,
+    Bounds3f&,
+    Bounds3f&) const override;
 
   bool intersectLeaf(uint32_t, uint32_t, const Ray3f&) const override;
   void intersectLeaf(uint32_t,
     uint32_t,
     const Ray3f&,
     Intersection&) const override;
+  RayMask intersectLeaf(uint32_t,
+    uint32_t,
+    const Ray3f*,
+    RayMask) const override;
+  void intersectLeaf(uint32_t,
+    uint32_t,
+    const Ray3f*,
+    RayMask,
+    Intersection*) const override;
+  void closestPointLeaf(uint32_t,
+    uint32_t,
+    const vec3f&,
+    ClosestPoint&) const override;
 
 }; // TriangleMeshBVH
 
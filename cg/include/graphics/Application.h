@@ -28,7 +28,7 @@
 // Class definition for graphics application.
 //
 // Author: Paulo Pagliosa
-// Last revision: 14/12/2022
+// Last revision: 17/10/2026
 
 #ifndef __Application_h
 #define __Application_h
@@ -68,6 +68,15 @@ public:
     return _baseDirectory;
   }
 
+  /// Sets the assets path, which is by default the subdirectory
+  /// "assets/" of the directory of the application executable.
+  static void setAssetsPath(const std::string& path)
+  {
+    _assetsPath = path;
+    if (!path.empty() && path.back() != '/' && path.back() != '\\')
+      _assetsPath += '/';
+  }
+
   /// Returns the asset file path for \c filename.
   static std::string assetFilePath(const char* filename)
   {
@@ -0,0 +1,179 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2026 Paulo Pagliosa.                              |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: ImageWriter.h
+// ========
+// Class definitions for image file writers.
+//
+// Author: Paulo Pagliosa
+// Last revision: 17/10/2026
+
+#ifndef __ImageWriter_h
+#define __ImageWriter_h
+
+#include "graphics/Image.h"
+#include <cstdio>
+#include <vector>
+
+namespace cg
+{ // begin namespace cg
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// ImageWriter: image file writer class
+// ===========
+class ImageWriter: public SharedObject
+{
+public:
+  /// Returns a new writer for the extension of filename (.ppm, .pfm,
+  /// or .png), or nullptr if the extension is unknown.
+  static ImageWriter* New(const char* filename);
+
+  ~ImageWriter() override;
+
+  /// Creates an image file and writes its header. Returns false if
+  /// the file cannot be created.
+  bool open(const char* filename, int width, int height);
+
+  /// Writes the trailer of the image file and closes it. Returns
+  /// false if any write has failed.
+  bool close();
+
+  bool isOpen() const
+  {
+    return _file != nullptr;
+  }
+
+  auto width() const
+  {
+    return _W;
+  }
+
+  auto height() const
+  {
+    return _H;
+  }
+
+  /// Returns true if the rows of the image are written from the
+  /// bottom row (y = 0) to the top one. Otherwise, they are written
+  /// from the top row (y = height - 1) to the bottom one.
+  virtual bool bottomUp() const
+  {
+    return false;
+  }
+
+  /// Writes the next row of the image from 8-bit RGB pixels.
+  virtual void writeRow(const Pixel*) = 0;
+  /// Writes the next row of the image from float RGB triplets.
+  virtual void writeRow(const float*) = 0;
+
+protected:
+  FILE* _file{};
+  int _W{};
+  int _H{};
+  bool _failed{};
+
+  void write(const void* data, size_t size)
+  {
+    if (!_failed && fwrite(data, 1, size, _file) != size)
+      _failed = true;
+  }
+
+  virtual void writeHeader() = 0;
+
+  virtual void writeTrailer()
+  {
+    // do nothing
+  }
+
+}; // ImageWriter
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// PPMWriter: binary PPM (P6) image file writer class
+// =========
+class PPMWriter final: public ImageWriter
+{
+public:
+  void writeRow(const Pixel*) override;
+  void writeRow(const float*) override;
+
+private:
+  std::vector<uint8_t> _row;
+
+  void writeHeader() override;
+
+}; // PPMWriter
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// PFMWriter: float RGB PFM image file writer class
+// =========
+class PFMWriter final: public ImageWriter
+{
+public:
+  bool bottomUp() const override
+  {
+    return true;
+  }
+
+  void writeRow(const Pixel*) override;
+  void writeRow(const float*) override;
+
+private:
+  std::vector<float> _row;
+
+  void writeHeader() override;
+
+}; // PFMWriter
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// PNGWriter: 8-bit RGB PNG image file writer class
+// =========
+class PNGWriter final: public ImageWriter
+{
+public:
+  void writeRow(const Pixel*) override;
+  void writeRow(const float*) override;
+
+private:
+  std::vector<uint8_t> _row;
+  uint32_t _adler;
+
+  void writeHeader() override;
+  void writeTrailer() override;
+  void writeChunk(const char* type, const uint8_t* data, size_t size);
+  void writeImageData(const uint8_t* data, size_t size, bool last);
+
+}; // PNGWriter
+
+} // end namespace cg
+
+#endif // __ImageWriter_h
@@ -0,0 +1,101 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2026 Paulo Pagliosa.                              |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: LightBVH.h
+// ========
+// Class definition for light BVH.
+//
+// Author: Paulo Pagliosa
+// Last revision: 17/10/2026
+
+#ifndef __LightBVH_h
+#define __LightBVH_h
+
+#include "geometry/BVH.h"
+#include "graphics/Light.h"
+
+namespace cg
+{ // begin namespace cg
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// LightBVH: light BVH class
+// ========
+// The primitives of the BVH are the spheres of influence of lights
+// with finite range, whose centers are the light positions and whose
+// radii are the light ranges. A point query finds the lights which
+// can incide at a point without visiting every light of a scene.
+class LightBVH final: public BVHBase
+{
+public:
+  using LightArray = std::vector<Reference<Light>>;
+
+  /// Constructs a BVH of point lights and spotlights with finite
+  /// range, which must not be changed while the BVH is used.
+  LightBVH(LightArray&& lights, uint32_t maxLightsPerNode = 2);
+
+  auto& lights() const
+  {
+    return _lights;
+  }
+
+  using BVHBase::query;
+
+  /// Writes the indices in lights() of the lights whose spheres of
+  /// influence may contain the point P to the output iterator, which
+  /// is returned past the last index written. The lights themselves
+  /// are not tested.
+  template <typename OutputIt>
+  OutputIt query(const vec3f& P, OutputIt out) const
+  {
+    return query(Bounds3f{P, P}, out);
+  }
+
+  /// Returns the bounds of the sphere of influence of a light.
+  static Bounds3f lightBounds(const Light& light)
+  {
+    auto r = light.range();
+    vec3f d{r, r, r};
+    const auto& p = light.position();
+
+    return {p - d, p + d};
+  }
+
+private:
+  LightArray _lights;
+
+  Bounds3f primitiveBounds(uint32_t) const override;
+  bool intersectLeaf(uint32_t, uint32_t, const Ray3f&) const override;
+  void intersectLeaf(uint32_t,
+    uint32_t,
+    const Ray3f&,
+    Intersection&) const override;
+
+}; // LightBVH
+
+} // end namespace cg
+
+#endif // __LightBVH_h
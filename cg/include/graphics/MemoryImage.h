@@ -0,0 +1,126 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2026 Paulo Pagliosa.                              |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: MemoryImage.h
+// ========
+// Class definition for image kept in main memory.
+//
+// Author: Paulo Pagliosa
+// Last revision: 17/10/2026
+
+#ifndef __MemoryImage_h
+#define __MemoryImage_h
+
+#include "graphics/ImageWriter.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace cg
+{ // begin namespace cg
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// MemoryImage: image kept in main memory
+// ===========
+class MemoryImage: public Image
+{
+public:
+  /// Constructs a width x height image of 8-bit RGB pixels or, if
+  /// hdr is true, of float RGB triplets.
+  MemoryImage(int width, int height, bool hdr = false);
+
+  /// Returns true if the pixels are float RGB triplets.
+  bool isHDR() const
+  {
+    return !_rgb.empty();
+  }
+
+  /// Does nothing, since the image has no texture.
+  void draw(int x = 0, int y = 0) const override;
+
+  /// Sets the colors of the w x h tile whose first pixel is (x,y).
+  /// The colors are stored in rows of stride colors; they are clamped
+  /// to [0,1] unless the image is HDR. Tiles which do not overlap can
+  /// be set concurrently by different threads.
+  void setTile(int x,
+    int y,
+    int w,
+    int h,
+    const Color* colors,
+    int stride);
+
+  /// Returns the y-th row of 8-bit RGB pixels, or nullptr if the
+  /// image is HDR.
+  const Pixel* pixelRow(int y) const
+  {
+    return isHDR() ? nullptr : &_pixels(0, y);
+  }
+
+  /// Returns the y-th row of float RGB triplets, or nullptr if the
+  /// image is not HDR.
+  const float* hdrRow(int y) const
+  {
+    return isHDR() ? _rgb.data() + size_t(y) * _W * 3 : nullptr;
+  }
+
+  /// Starts streaming the rows of the image to an open writer of the
+  /// same size. A row is written, in the order of the writer, as soon
+  /// as all of its pixels have been set since this call, by setTile()
+  /// or setData(), and all the rows before it have been written.
+  /// Neither this method nor closeWriter() can be called while other
+  /// threads are setting tiles.
+  void setWriter(ImageWriter& writer);
+
+  /// Writes the rows not streamed yet, closes the writer, and stops
+  /// streaming. Returns false if any write has failed.
+  bool closeWriter();
+
+  /// Writes the image to a file whose format is given by the file
+  /// extension (.ppm, .pfm, or .png).
+  bool write(const char* filename) const;
+
+protected:
+  void setSubImage(int, int, int, int, const Pixel*) override;
+  void getSubImage(int, int, int, int, Pixel*) const override;
+
+private:
+  ImageBuffer _pixels;
+  std::vector<float> _rgb;
+  // Number of pixels of each row set since the writer was set
+  std::unique_ptr<std::atomic<int>[]> _rowCounts;
+  Reference<ImageWriter> _writer;
+  int _writtenRows{};
+  std::mutex _writerLock;
+
+  void writeRow(ImageWriter&, int y) const;
+  void rowsChanged(int y, int h, int w);
+
+}; // MemoryImage
+
+} // end namespace cg
+
+#endif // __MemoryImage_h
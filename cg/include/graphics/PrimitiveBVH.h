@@ -28,7 +28,7 @@
 // Class definition for primitive BVH.
 //
 // Author: Paulo Pagliosa
-// Last revision: 24/01/2022
+// Last revision: 17/10/2026
 
 #ifndef __PrimitiveBVH_h
 #define __PrimitiveBVH_h
@@ -48,6 +48,9 @@ class PrimitiveBVH final: public Aggregate
 {
 public:
   using PrimitiveArray = typename BVH<Primitive>::PrimitiveArray;
+  using RayMask = BVHBase::RayMask;
+
+  static constexpr auto maxPacketSize = BVHBase::maxPacketSize;
 
   PrimitiveBVH(PrimitiveArray&& primitives):
     _bvh{new BVH<Primitive>{std::move(primitives)}}
@@ -60,8 +63,31 @@ public:
     return _bvh->primitives();
   }
 
+  auto width() const
+  {
+    return _bvh->width();
+  }
+
+  void setWidth(uint32_t width)
+  {
+    _bvh->setWidth(width);
+  }
+
+  /// Refits the BVH to the current bounds of the primitives (see
+  /// BVHBase::refit()).
+  bool refit(float maxCostRatio = 0)
+  {
+    return _bvh->refit(maxCostRatio);
+  }
+
   Bounds3f bounds() const override;
 
+  using Aggregate::intersect;
+
+  /// Packet queries of world rays (see BVHBase).
+  RayMask intersect(std::span<const Ray3f>) const;
+  RayMask intersect(std::span<const Ray3f>, std::span<Intersection>) const;
+
 private:
   Reference<BVH<Primitive>> _bvh;
 
@@ -28,13 +28,14 @@
 // Class definition for generic transformable object.
 //
 // Author: Paulo Pagliosa
-// Last revision: 14/03/2022
+// Last revision: 17/10/2026
 
 #ifndef __TransformableObject_h
 #define __TransformableObject_h
 
 #include "core/SharedObject.h"
 #include "math/Matrix4x4.h"
+#include <cinttypes>
 
 namespace cg
 { // begin namespace cg
@@ -57,12 +58,19 @@ public:
     return _worldToLocal;
   }
 
+  /// Returns a stamp that changes whenever the transform is set.
+  auto transformStamp() const
+  {
+    return _transformStamp;
+  }
+
   virtual void setTransform(const mat4f&, const mat4f&);
   virtual void setTransform(const vec3f&, const quatf&, const vec3f&);
 
 protected:
   mat4f _localToWorld{1.0f};
   mat4f _worldToLocal{1.0f};
+  uint32_t _transformStamp{};
 
 }; // TransformableObject
 
@@ -28,13 +28,15 @@
 // Class definition for triangle mesh shape.
 //
 // Author: Paulo Pagliosa
-// Last revision: 21/06/2023
+// Last revision: 17/10/2026
 
 #ifndef __TriangleMeshShape_h
 #define __TriangleMeshShape_h
 
 #include "geometry/TriangleMeshBVH.h"
 #include "graphics/Shape.h"
+#include <atomic>
+#include <mutex>
 
 namespace cg
 { // begin namespace cg
@@ -61,12 +63,52 @@ public:
 
   void setMesh(const TriangleMesh&);
 
+  auto bvhWidth() const
+  {
+    return _bvhWidth;
+  }
+
+  /// Sets the width of the BVH of the shape (2, 4, or 8). The shapes
+  /// of a mesh share one BVH per width, thus the BVH used by other
+  /// shapes is never changed.
+  void setBVHWidth(uint32_t);
+
+  /// Sets the directory where the BVHs of the meshes are cached.
+  /// BVHs are loaded from the cache, if possible, instead of being
+  /// built. A null or empty path disables the cache (default).
+  static void setBVHCacheDirectory(const char*);
+
+  static constexpr size_t defaultBVHCacheBudget = size_t(512) << 20;
+
+  /// Sets the maximum number of bytes of the BVHs kept in memory by
+  /// the cache shared by all shapes. Least recently used BVHs not
+  /// used by any shape are evicted to meet the budget; BVHs in use
+  /// are never evicted, though.
+  static void setBVHCacheBudget(size_t);
+
+  struct BVHCacheStatistics
+  {
+    uint64_t hits;
+    uint64_t misses; // BVHs built or loaded from files
+    uint64_t evictions;
+    uint32_t bvhCount;
+    size_t memory;
+    size_t budget;
+
+  }; // BVHCacheStatistics
+
+  static BVHCacheStatistics bvhCacheStatistics();
+
 protected:
   TriangleMeshBVH* bvh() const;
 
 private:
   Reference<TriangleMesh> _mesh;
   mutable Reference<TriangleMeshBVH> _bvh;
+  // The BVH read by concurrent queries, once fetched from the cache
+  mutable std::atomic<TriangleMeshBVH*> _bvhPointer{};
+  mutable std::mutex _bvhLock;
+  uint32_t _bvhWidth{2};
 
   bool localIntersect(const Ray3f&) const final;
   bool localIntersect(const Ray3f&, Intersection&) const final;
@@ -28,11 +28,34 @@
 // Source file for BVH.
 //
 // Author: Paulo Pagliosa
-// Last revision: 01/05/2024
+// Last revision: 17/10/2026
 
+#include "core/Parallel.h"
 #include "geometry/BVH.h"
 #include <algorithm>
-#include <stack>
+#include <bit>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+
+// SIMD slab tests of wide nodes (define BVH_NO_SIMD for scalar tests)
+#ifndef BVH_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define BVH_USE_SSE
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define BVH_USE_AVX
+#include <immintrin.h>
+#endif
+#endif // BVH_NO_SIMD
+
+// Query counters (define BVH_STATS to update them)
+#ifdef BVH_STATS
+#define BVH_COUNT(counter, n) (threadQueryCounters.counter += (n))
+#else
+#define BVH_COUNT(counter, n) ((void)0)
+#endif // BVH_STATS
 
 namespace cg
 { // begin namespace cg
@@ -42,6 +65,13 @@ namespace cg
 //
 // BVHBase implementation
 // =======
+namespace
+{ // begin namespace
+
+thread_local BVHBase::QueryCounters threadQueryCounters{};
+
+} // end namespace
+
 class BVHBase::NodeRay: public Ray3f
 {
 public:
@@ -60,12 +90,14 @@ public:
 }; // BVHBase::NodeRay
 
 inline bool
-BVHBase::Node::intersect(const NodeRay& r) const
+BVHBase::Node::intersect(const Ray3f& r,
+  const vec3f& invDir,
+  const int* isNegDir) const
 {
-  auto tMin = (_bounds[r.isNegDir[0]].x - r.origin.x) * r.invDir.x;
-  auto tMax = (_bounds[1 - r.isNegDir[0]].x - r.origin.x) * r.invDir.x;
-  auto aMin = (_bounds[r.isNegDir[1]].y - r.origin.y) * r.invDir.y;
-  auto aMax = (_bounds[1 - r.isNegDir[1]].y - r.origin.y) * r.invDir.y;
+  auto tMin = (_bounds[isNegDir[0]].x - r.origin.x) * invDir.x;
+  auto tMax = (_bounds[1 - isNegDir[0]].x - r.origin.x) * invDir.x;
+  auto aMin = (_bounds[isNegDir[1]].y - r.origin.y) * invDir.y;
+  auto aMax = (_bounds[1 - isNegDir[1]].y - r.origin.y) * invDir.y;
 
   if (tMin > aMax || aMin > tMax)
     return false;
@@ -73,8 +105,8 @@ BVHBase::Node::intersect(const NodeRay& r) const
     tMin = aMin;
   if (aMax < tMax)
     tMax = aMax;
-  aMin = (_bounds[r.isNegDir[2]].z - r.origin.z) * r.invDir.z;
-  aMax = (_bounds[1 - r.isNegDir[2]].z - r.origin.z) * r.invDir.z;
+  aMin = (_bounds[isNegDir[2]].z - r.origin.z) * invDir.z;
+  aMax = (_bounds[1 - isNegDir[2]].z - r.origin.z) * invDir.z;
   if (tMin > aMax || aMin > tMax)
     return false;
   if (aMin > tMin)
@@ -84,146 +116,2268 @@ BVHBase::Node::intersect(const NodeRay& r) const
   return tMin < r.tMax && tMax > r.tMin;
 }
 
-void
-BVHBase::Node::iterate(const Node* node, NodeFunction f)
+inline bool
+BVHBase::Node::intersect(const NodeRay& r) const
 {
-  if (node == nullptr)
-    return;
+  return intersect(r, r.invDir, r.isNegDir);
+}
+
+// Rays of a packet are traversed together only if their directions
+// have the same signs, so that all of them visit the children of an
+// interior node in the same order
+class BVHBase::RayPacket
+{
+public:
+  explicit RayPacket(std::span<const Ray3f> r):
+    size{uint32_t(r.size())},
+    mask{size == maxPacketSize ? ~RayMask{} : (RayMask{1} << size) - 1},
+    coherent{true}
+  {
+    assert(size <= maxPacketSize);
+    for (uint32_t i = 0; i < size; ++i)
+    {
+      rays[i] = r[i];
+      invDir[i] = r[i].direction.inverse();
+      for (int k = 0; k < 3; ++k)
+      {
+        int s = r[i].direction[k] < 0;
+
+        if (i == 0)
+          isNegDir[k] = s;
+        else if (s != isNegDir[k])
+          coherent = false;
+      }
+    }
+  }
 
-  auto isLeaf = node->isLeaf();
+  uint32_t size;
+  RayMask mask;
+  bool coherent;
+  Ray3f rays[maxPacketSize];
+  vec3f invDir[maxPacketSize];
+  int isNegDir[3];
 
-  f(node);
-  if (!node->isLeaf())
+  RayMask intersect(const Node* node, RayMask active) const
   {
-    iterate(node->_children[0], f);
-    iterate(node->_children[1], f);
+    RayMask hitMask{};
+
+    for (; active != 0; active &= active - 1)
+    {
+      auto i = std::countr_zero(active);
+
+      if (node->intersect(rays[i], invDir[i], isNegDir))
+        hitMask |= RayMask{1} << i;
+    }
+    return hitMask;
   }
+
+}; // BVHBase::RayPacket
+
+inline auto
+maxDim(const Bounds3f& b)
+{
+  auto s = b.size();
+  return s.x > s.y && s.x > s.z ? 0 : (s.y > s.z ? 1 : 2);
 }
 
-inline BVHBase::Node*
-BVHBase::makeLeaf(PrimitiveInfoArray& primitiveInfo,
-  uint32_t start,
-  uint32_t end,
-  IndexArray& orderedPrimitiveIds)
+namespace
+{ // begin namespace
+
+// Number of buckets and cost of a node traversal relative to the
+// cost of a primitive intersection used by the SAH
+constexpr auto sahBucketCount = 12;
+constexpr auto sahTraversalCost = 0.125f;
+
+// Minimum number of primitives of a subtree built by a parallel task
+constexpr auto parallelBuildThreshold = 16384u;
+
+// Number of bins of spatial splits, maximum number of duplicated
+// references relative to the number of primitives, and minimum area
+// of the overlap of the children of an object split, relative to the
+// area of the root, for trying a spatial split (SBVH)
+constexpr auto sbvhBinCount = 16;
+constexpr auto sbvhMaxDuplication = 0.5f;
+constexpr auto sbvhMinOverlap = 1e-5f;
+
+struct SAHBucket
+{
+  uint32_t count{};
+  Bounds3f bounds;
+
+}; // SAHBucket
+
+struct ObjectSplit
+{
+  float cost{math::Limits<float>::inf()};
+  int bucket{};
+  Bounds3f leftBounds;
+  Bounds3f rightBounds;
+
+}; // ObjectSplit
+
+struct SpatialBin
 {
   Bounds3f bounds;
-  auto first = uint32_t(orderedPrimitiveIds.size());
+  uint32_t enter{}; // number of references starting in the bin
+  uint32_t exit{}; // number of references ending in the bin
+
+}; // SpatialBin
+
+struct SpatialSplit
+{
+  float cost{math::Limits<float>::inf()};
+  float position;
+
+}; // SpatialSplit
 
-  for (uint32_t i = start; i < end; ++i)
+inline auto
+sahBucketIndex(float centroid, float cMin, float scale)
+{
+  auto b = int((centroid - cMin) * scale);
+  return b < sahBucketCount ? b : sahBucketCount - 1;
+}
+
+// Empty boxes have min > max, and must not inflate other boxes,
+// whereas flat boxes (e.g., of axis-aligned triangles) are not empty
+inline bool
+isEmpty(const Bounds3f& b)
+{
+  const auto& p1 = b.min();
+  const auto& p2 = b.max();
+  return p1.x > p2.x || p1.y > p2.y || p1.z > p2.z;
+}
+
+inline Bounds3f
+intersection(const Bounds3f& a, const Bounds3f& b)
+{
+  Bounds3f c;
+  auto p1 = a.min();
+  auto p2 = a.max();
+
+  for (int k = 0; k < 3; ++k)
   {
-    bounds.inflate(primitiveInfo[i].bounds);
-    orderedPrimitiveIds.push_back(_primitiveIds[primitiveInfo[i].index]);
+    p1[k] = std::max(p1[k], b.min()[k]);
+    p2[k] = std::min(p2[k], b.max()[k]);
+    if (p1[k] > p2[k])
+      return c;
   }
-  return new Node{bounds, first, end - start};
+  c.set(p1, p2);
+  return c;
 }
 
-inline auto
-maxDim(const Bounds3f& b)
+// Spreads the 10 lower bits of v so that there are two zero bits
+// between each of them
+inline uint32_t
+expandBits(uint32_t v)
 {
-  auto s = b.size();
-  return s.x > s.y && s.x > s.z ? 0 : (s.y > s.z ? 1 : 2);
+  v = (v * 0x00010001u) & 0xff0000ffu;
+  v = (v * 0x00000101u) & 0x0f00f00fu;
+  v = (v * 0x00000011u) & 0xc30c30c3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
 }
 
-BVHBase::Node*
-BVHBase::makeNode(PrimitiveInfoArray& primitiveInfo,
-  uint32_t start,
-  uint32_t end,
-  IndexArray& orderedPrimitiveIds)
+// Returns the 30-bit Morton code of a point p in [0,1]^3
+inline uint32_t
+mortonCode(const vec3f& p)
 {
-  ++_nodeCount;
-  if (end - start <= _maxPrimitivesPerNode)
-    return makeLeaf(primitiveInfo, start, end, orderedPrimitiveIds);
+  auto q = [](float x)
+  {
+    return expandBits(uint32_t(std::clamp(x * 1024.0f, 0.0f, 1023.0f)));
+  };
+  return (q(p.x) << 2) | (q(p.y) << 1) | q(p.z);
+}
+
+} // end namespace
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// BVHBase::Builder: BVH builder class
+// ================
+class BVHBase::Builder
+{
+public:
+  Builder(const BVHBase&, PrimitiveInfoArray&);
+
+  void build(NodeArray&);
+
+private:
+  const BVHBase& _bvh;
+  PrimitiveInfoArray& _primitiveInfo;
+  IndexArray _mortonCodes;
+  uint32_t _maxPrimitivesPerNode;
+  SplitMethod _splitMethod;
+  uint32_t _maxTaskDepth;
+  float _rootArea;
+
+  uint32_t makeNode(NodeArray&, uint32_t, uint32_t, uint32_t);
+  void makeLeaf(Node&, uint32_t, uint32_t);
+  uint32_t splitMedian(uint32_t, uint32_t, int);
+  uint32_t splitSAH(uint32_t, uint32_t, int, const Bounds3f&, const Bounds3f&);
+  uint32_t splitMorton(uint32_t, uint32_t, bool, int&);
+  void sortByMortonCodes();
+  ObjectSplit findObjectSplit(const PrimitiveInfo*,
+    uint32_t,
+    int,
+    const Bounds3f&) const;
+
+  // Spatial split BVH
+  uint32_t makeSpatialNode(NodeArray&,
+    PrimitiveInfoArray&,
+    PrimitiveInfoArray&&,
+    uint32_t,
+    uint32_t);
+  SpatialSplit findSpatialSplit(const PrimitiveInfoArray&,
+    int,
+    const Bounds3f&,
+    uint32_t) const;
+  void splitReference(const PrimitiveInfo&,
+    int,
+    float,
+    PrimitiveInfo&,
+    PrimitiveInfo&) const;
+
+}; // BVHBase::Builder
+
+BVHBase::Builder::Builder(const BVHBase& bvh,
+  PrimitiveInfoArray& primitiveInfo):
+  _bvh{bvh},
+  _primitiveInfo{primitiveInfo},
+  _maxPrimitivesPerNode{bvh._maxPrimitivesPerNode},
+  _splitMethod{bvh._splitMethod}
+{
+  // Subtrees are built in parallel up to a depth giving about two
+  // tasks per hardware thread
+  _maxTaskDepth = std::bit_width(hardwareThreadCount());
+  if (_splitMethod == SplitMethod::Morton)
+    sortByMortonCodes();
+}
+
+void
+BVHBase::Builder::build(NodeArray& nodes)
+{
+  auto np = uint32_t(_primitiveInfo.size());
+
+  if (_splitMethod != SplitMethod::SBVH)
+  {
+    makeNode(nodes, 0, np, 0);
+    return;
+  }
 
+  // Spatial splits clip primitives into new references. Leaves refer
+  // to ranges of an array of references in leaf order, which replaces
+  // the primitive info array
+  Bounds3f bounds;
+
+  for (const auto& p : _primitiveInfo)
+    bounds.inflate(p.bounds);
+  _rootArea = bounds.area();
+
+  auto budget = uint32_t(np * sbvhMaxDuplication);
+  PrimitiveInfoArray refs{std::move(_primitiveInfo)};
+  PrimitiveInfoArray leafRefs;
+
+  leafRefs.reserve(np + budget);
+  makeSpatialNode(nodes, leafRefs, std::move(refs), 0, budget);
+  _primitiveInfo.swap(leafRefs);
+}
+
+void
+BVHBase::Builder::sortByMortonCodes()
+{
+  auto np = uint32_t(_primitiveInfo.size());
   Bounds3f centroidBounds;
 
-  for (auto i = start; i < end; ++i)
-    centroidBounds.inflate(primitiveInfo[i].centroid);
+  for (const auto& p : _primitiveInfo)
+    centroidBounds.inflate(p.centroid);
 
-  auto dim = maxDim(centroidBounds);
+  auto cMin = centroidBounds.min();
+  auto scale = centroidBounds.size();
 
-  if (centroidBounds.max()[dim] == centroidBounds.min()[dim])
-    return makeLeaf(primitiveInfo, start, end, orderedPrimitiveIds);
+  for (auto i = 0; i < 3; ++i)
+    scale[i] = scale[i] > 0 ? 1 / scale[i] : 0;
 
-  // Partition primitives into two sets and build children
+  // Sort (code, index) keys, which are unique, so that the order of
+  // primitives does not depend on the sorting algorithm
+  std::vector<uint64_t> keys(np);
+
+  parallelFor(np, [&](uint32_t i)
+  {
+    auto p = (_primitiveInfo[i].centroid - cMin) * scale;
+
+    keys[i] = uint64_t(mortonCode(p)) << 32 | i;
+  });
+  std::sort(keys.begin(), keys.end());
+
+  PrimitiveInfoArray sortedPrimitiveInfo(np);
+
+  _mortonCodes.resize(np);
+  parallelFor(np, [&](uint32_t i)
+  {
+    sortedPrimitiveInfo[i] = _primitiveInfo[uint32_t(keys[i])];
+    _mortonCodes[i] = uint32_t(keys[i] >> 32);
+  });
+  _primitiveInfo.swap(sortedPrimitiveInfo);
+}
+
+inline void
+BVHBase::Builder::makeLeaf(Node& node, uint32_t start, uint32_t end)
+{
+  Bounds3f bounds;
+
+  for (auto i = start; i < end; ++i)
+    bounds.inflate(_primitiveInfo[i].bounds);
+  // A leaf refers to its range of the partitioned primitive info
+  node.setLeaf(bounds, start, end - start);
+}
+
+uint32_t
+BVHBase::Builder::splitMedian(uint32_t start, uint32_t end, int dim)
+{
   auto mid = (start + end) / 2;
 
-  std::nth_element(&primitiveInfo[start],
-    &primitiveInfo[mid],
-    &primitiveInfo[end - 1] + 1,
+  std::nth_element(&_primitiveInfo[start],
+    &_primitiveInfo[mid],
+    &_primitiveInfo[end - 1] + 1,
     [dim](const PrimitiveInfo& a, const PrimitiveInfo& b)
     {
       return a.centroid[dim] < b.centroid[dim];
     });
-  return new Node{makeNode(primitiveInfo, start, mid, orderedPrimitiveIds),
-    makeNode(primitiveInfo, mid, end, orderedPrimitiveIds)};
+  return mid;
 }
 
-BVHBase::~BVHBase()
+ObjectSplit
+BVHBase::Builder::findObjectSplit(const PrimitiveInfo* p,
+  uint32_t count,
+  int dim,
+  const Bounds3f& centroidBounds) const
 {
-  delete _root;
-}
+  auto cMin = centroidBounds.min()[dim];
+  auto scale = sahBucketCount / (centroidBounds.max()[dim] - cMin);
+  SAHBucket buckets[sahBucketCount];
 
-bool
-BVHBase::intersect(const Ray3f& ray) const
-{
-  NodeRay r{ray};
-  std::stack<Node*> stack;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    auto& b = buckets[sahBucketIndex(p[i].centroid[dim], cMin, scale)];
 
-  stack.push(_root);
-  while (!stack.empty())
+    ++b.count;
+    b.bounds.inflate(p[i].bounds);
+  }
+
+  // Sweep the buckets from right to left accumulating the bounds of
+  // the right sides, then from left to right to find the best split
+  Bounds3f rightBounds[sahBucketCount - 1];
+  float rightCost[sahBucketCount - 1];
+  Bounds3f sideBounds;
+  uint32_t sideCount{};
+
+  for (auto i = sahBucketCount - 1; i > 0; --i)
   {
-    auto node = stack.top();
+    if (buckets[i].count > 0)
+      sideBounds.inflate(buckets[i].bounds);
+    sideCount += buckets[i].count;
+    rightBounds[i - 1] = sideBounds;
+    rightCost[i - 1] = sideCount > 0 ? sideCount * sideBounds.area() : 0;
+  }
+  sideBounds.setEmpty();
+  sideCount = 0;
 
-    stack.pop();
-    if (node->intersect(r))
-      if (!node->isLeaf())
-      {
-        stack.push(node->_children[0]);
-        stack.push(node->_children[1]);
-      }
-      else if (intersectLeaf(node->_first, node->_count, ray))
-        return true;
+  ObjectSplit split;
+
+  for (auto i = 0; i < sahBucketCount - 1; ++i)
+  {
+    if (buckets[i].count > 0)
+      sideBounds.inflate(buckets[i].bounds);
+    sideCount += buckets[i].count;
+    if (sideCount == 0 || rightCost[i] == 0)
+      continue;
+
+    auto cost = sideCount * sideBounds.area() + rightCost[i];
+
+    if (cost < split.cost)
+    {
+      split.cost = cost;
+      split.bucket = i;
+      split.leftBounds = sideBounds;
+      split.rightBounds = rightBounds[i];
+    }
   }
-  return false;
+  return split;
 }
 
-bool
-BVHBase::intersect(const Ray3f& ray, Intersection& hit) const
+uint32_t
+BVHBase::Builder::splitSAH(uint32_t start,
+  uint32_t end,
+  int dim,
+  const Bounds3f& bounds,
+  const Bounds3f& centroidBounds)
 {
-  hit.object = nullptr;
-  hit.distance = ray.tMax;
+  auto count = end - start;
+  auto split = findObjectSplit(&_primitiveInfo[start],
+    count,
+    dim,
+    centroidBounds);
 
-  NodeRay r{ray};
-  std::stack<Node*> stack;
+  // Compare the split and leaf costs scaled by the area of the node
+  auto area = bounds.area();
+
+  if (count <= _maxPrimitivesPerNode &&
+    !(sahTraversalCost * area + split.cost < count * area))
+    return start;
+
+  auto cMin = centroidBounds.min()[dim];
+  auto scale = sahBucketCount / (centroidBounds.max()[dim] - cMin);
+  auto mid = std::partition(_primitiveInfo.begin() + start,
+    _primitiveInfo.begin() + end,
+    [&](const PrimitiveInfo& p)
+    {
+      return sahBucketIndex(p.centroid[dim], cMin, scale) <= split.bucket;
+    });
+  return uint32_t(mid - _primitiveInfo.begin());
+}
+
+uint32_t
+BVHBase::Builder::splitMorton(uint32_t start,
+  uint32_t end,
+  bool balanced,
+  int& dim)
+{
+  auto c0 = _mortonCodes[start];
+  auto c1 = _mortonCodes[end - 1];
+
+  dim = 0;
+  if (balanced || c0 == c1)
+    return (start + end) / 2;
+
+  // Split where the highest bit differing in the range changes. The
+  // code bits of the x, y, and z axes are 2, 1, and 0 (mod 3)
+  auto bit = 31 - std::countl_zero(c0 ^ c1);
+  auto mask = 1u << bit;
+  auto mid = std::partition_point(_mortonCodes.begin() + start,
+    _mortonCodes.begin() + end,
+    [mask](uint32_t c)
+    {
+      return (c & mask) == 0;
+    });
+
+  dim = 2 - bit % 3;
+  return uint32_t(mid - _mortonCodes.begin());
+}
+
+uint32_t
+BVHBase::Builder::makeNode(NodeArray& nodes,
+  uint32_t start,
+  uint32_t end,
+  uint32_t depth)
+{
+  auto index = uint32_t(nodes.size());
+
+  nodes.emplace_back();
+
+  // SAH and Morton splits can be arbitrarily unbalanced, so fall back
+  // to balanced splits when needed to keep the depth within maxDepth
+  auto count = end - start;
+  auto balanced = depth + std::bit_width(count) >= maxDepth;
+  auto method = _splitMethod;
 
-  stack.push(_root);
-  while (!stack.empty())
+  if (method == SplitMethod::SAH && balanced)
+    method = SplitMethod::Median;
+
+  // With SAH, the leaf creation is decided by the split cost
+  auto sah = method == SplitMethod::SAH;
+
+  if (count <= (sah ? 1 : _maxPrimitivesPerNode))
+    return makeLeaf(nodes[index], start, end), index;
+
+  // Partition primitives into two sets and build children
+  uint32_t mid;
+  int dim;
+
+  if (method == SplitMethod::Morton)
+    mid = splitMorton(start, end, balanced, dim);
+  else
   {
-    auto node = stack.top();
+    Bounds3f bounds;
+    Bounds3f centroidBounds;
 
-    stack.pop();
-    if (node->intersect(r))
-      if (node->isLeaf())
-        intersectLeaf(node->_first, node->_count, ray, hit);
-      else
-      {
-        stack.push(node->_children[0]);
-        stack.push(node->_children[1]);
-      }
+    for (auto i = start; i < end; ++i)
+    {
+      if (sah)
+        bounds.inflate(_primitiveInfo[i].bounds);
+      centroidBounds.inflate(_primitiveInfo[i].centroid);
+    }
+    dim = maxDim(centroidBounds);
+    if (centroidBounds.max()[dim] == centroidBounds.min()[dim])
+      return makeLeaf(nodes[index], start, end), index;
+    mid = sah ?
+      splitSAH(start, end, dim, bounds, centroidBounds) :
+      splitMedian(start, end, dim);
+    if (mid == start)
+      return makeLeaf(nodes[index], start, end), index;
   }
-  return hit.object != nullptr;
+
+  // The first child is built right after its parent in the node array.
+  // Large second subtrees are built concurrently into their own arrays
+  // and appended afterwards; since node offsets are relative and leaves
+  // refer to primitive info ranges, the resulting array does not depend
+  // on the number of threads
+  if (depth < _maxTaskDepth && end - mid >= parallelBuildThreshold)
+  {
+    NodeArray secondNodes;
+    auto task = std::async(std::launch::async, [&]()
+    {
+      makeNode(secondNodes, mid, end, depth + 1);
+    });
+
+    makeNode(nodes, start, mid, depth + 1);
+    task.get();
+
+    auto secondChild = uint32_t(nodes.size());
+
+    nodes.insert(nodes.end(), secondNodes.begin(), secondNodes.end());
+    nodes[index].setInterior(secondChild - index, dim);
+  }
+  else
+  {
+    makeNode(nodes, start, mid, depth + 1);
+
+    auto secondChild = makeNode(nodes, mid, end, depth + 1);
+
+    nodes[index].setInterior(secondChild - index, dim);
+  }
+  return index;
 }
 
-Bounds3f
-BVHBase::bounds() const
+void
+BVHBase::Builder::splitReference(const PrimitiveInfo& ref,
+  int dim,
+  float position,
+  PrimitiveInfo& left,
+  PrimitiveInfo& right) const
 {
-  return _root == nullptr ? Bounds3f{} : _root->_bounds;
+  Bounds3f leftBounds;
+  Bounds3f rightBounds;
+
+  // The parts of the primitive are clipped by the bounds of the
+  // reference, which may have been split before
+  _bvh.splitPrimitive(_bvh._primitiveIds[ref.index],
+    dim,
+    position,
+    leftBounds,
+    rightBounds);
+  left.index = right.index = ref.index;
+  left.bounds = intersection(leftBounds, ref.bounds);
+  right.bounds = intersection(rightBounds, ref.bounds);
+  if (!isEmpty(left.bounds))
+    left.centroid = left.bounds.center();
+  if (!isEmpty(right.bounds))
+    right.centroid = right.bounds.center();
 }
 
-void
-BVHBase::iterate(NodeFunction f) const
+SpatialSplit
+BVHBase::Builder::findSpatialSplit(const PrimitiveInfoArray& refs,
+  int dim,
+  const Bounds3f& bounds,
+  uint32_t budget) const
+{
+  auto origin = bounds.min()[dim];
+  auto binSize = (bounds.max()[dim] - origin) / sbvhBinCount;
+
+  if (!(binSize > 0))
+    return {};
+
+  auto invBinSize = 1 / binSize;
+  auto binIndex = [&](float x)
+  {
+    return std::clamp(int((x - origin) * invBinSize), 0, sbvhBinCount - 1);
+  };
+  SpatialBin bins[sbvhBinCount];
+
+  // Each reference is chopped into the bins it overlaps
+  for (const auto& r : refs)
+  {
+    auto first = binIndex(r.bounds.min()[dim]);
+    auto last = binIndex(r.bounds.max()[dim]);
+    auto ref = r;
+
+    for (auto b = first; b < last; ++b)
+    {
+      PrimitiveInfo left;
+      PrimitiveInfo right;
+
+      splitReference(ref, dim, origin + (b + 1) * binSize, left, right);
+      if (!isEmpty(left.bounds))
+        bins[b].bounds.inflate(left.bounds);
+      ref.bounds = right.bounds;
+      if (isEmpty(ref.bounds))
+        break;
+    }
+    if (!isEmpty(ref.bounds))
+      bins[last].bounds.inflate(ref.bounds);
+    ++bins[first].enter;
+    ++bins[last].exit;
+  }
+
+  // Sweep the bins as in object splits. A reference is counted on
+  // both sides of the planes crossing it
+  Bounds3f rightBounds[sbvhBinCount - 1];
+  uint32_t rightCount[sbvhBinCount - 1];
+  Bounds3f sideBounds;
+  uint32_t sideCount{};
+
+  for (auto i = sbvhBinCount - 1; i > 0; --i)
+  {
+    if (!isEmpty(bins[i].bounds))
+      sideBounds.inflate(bins[i].bounds);
+    sideCount += bins[i].exit;
+    rightBounds[i - 1] = sideBounds;
+    rightCount[i - 1] = sideCount;
+  }
+  sideBounds.setEmpty();
+  sideCount = 0;
+
+  auto count = uint32_t(refs.size());
+  SpatialSplit split;
+
+  for (auto i = 0; i < sbvhBinCount - 1; ++i)
+  {
+    if (!isEmpty(bins[i].bounds))
+      sideBounds.inflate(bins[i].bounds);
+    sideCount += bins[i].enter;
+    if (sideCount == 0 || rightCount[i] == 0 ||
+      sideCount + rightCount[i] - count > budget)
+      continue;
+
+    auto cost = sideCount * sideBounds.area() +
+      rightCount[i] * rightBounds[i].area();
+
+    if (cost < split.cost)
+    {
+      split.cost = cost;
+      split.position = origin + (i + 1) * binSize;
+    }
+  }
+  return split;
+}
+
+uint32_t
+BVHBase::Builder::makeSpatialNode(NodeArray& nodes,
+  PrimitiveInfoArray& leafRefs,
+  PrimitiveInfoArray&& refs,
+  uint32_t depth,
+  uint32_t budget)
 {
-  Node::iterate(_root, f);
+  auto index = uint32_t(nodes.size());
+  auto count = uint32_t(refs.size());
+  Bounds3f bounds;
+  Bounds3f centroidBounds;
+
+  nodes.emplace_back();
+  for (const auto& r : refs)
+  {
+    bounds.inflate(r.bounds);
+    centroidBounds.inflate(r.centroid);
+  }
+
+  auto makeLeaf = [&]()
+  {
+    nodes[index].setLeaf(bounds, uint32_t(leafRefs.size()), count);
+    leafRefs.insert(leafRefs.end(), refs.begin(), refs.end());
+    return index;
+  };
+
+  if (count <= 1)
+    return makeLeaf();
+
+  auto balanced = depth + std::bit_width(count) >= maxDepth;
+  auto dim = maxDim(centroidBounds);
+  auto flat = centroidBounds.max()[dim] == centroidBounds.min()[dim];
+  PrimitiveInfoArray left;
+  PrimitiveInfoArray right;
+
+  if (balanced)
+  {
+    if (flat)
+      return makeLeaf();
+
+    auto mid = refs.begin() + count / 2;
+
+    std::nth_element(refs.begin(),
+      mid,
+      refs.end(),
+      [dim](const PrimitiveInfo& a, const PrimitiveInfo& b)
+      {
+        return a.centroid[dim] < b.centroid[dim];
+      });
+    left.assign(refs.begin(), mid);
+    right.assign(mid, refs.end());
+  }
+  else
+  {
+    ObjectSplit objectSplit;
+
+    if (!flat)
+      objectSplit = findObjectSplit(refs.data(), count, dim, centroidBounds);
+
+    // A spatial split is tried only if the children of the object
+    // split overlap, and duplicated references fit the budget
+    SpatialSplit spatialSplit;
+    auto spatialDim = maxDim(bounds);
+
+    if (budget > 0)
+    {
+      auto overlap = intersection(objectSplit.leftBounds,
+        objectSplit.rightBounds);
+
+      if (flat ||
+        (!isEmpty(overlap) && overlap.area() > sbvhMinOverlap * _rootArea))
+        spatialSplit = findSpatialSplit(refs, spatialDim, bounds, budget);
+    }
+
+    auto cost = std::min(objectSplit.cost, spatialSplit.cost);
+    auto area = bounds.area();
+
+    if (cost == math::Limits<float>::inf() ||
+      (count <= _maxPrimitivesPerNode &&
+      !(sahTraversalCost * area + cost < count * area)))
+      return makeLeaf();
+    if (spatialSplit.cost < objectSplit.cost)
+    {
+      auto position = spatialSplit.position;
+
+      dim = spatialDim;
+      for (const auto& r : refs)
+        if (r.bounds.max()[dim] <= position)
+          left.push_back(r);
+        else if (r.bounds.min()[dim] >= position)
+          right.push_back(r);
+        else
+        {
+          PrimitiveInfo lr;
+          PrimitiveInfo rr;
+
+          // Keep the whole reference if clipping loses one of its
+          // sides due to rounding
+          splitReference(r, dim, position, lr, rr);
+          if (isEmpty(lr.bounds))
+            right.push_back(r);
+          else if (isEmpty(rr.bounds))
+            left.push_back(r);
+          else
+          {
+            left.push_back(lr);
+            right.push_back(rr);
+          }
+        }
+    }
+    else
+    {
+      auto cMin = centroidBounds.min()[dim];
+      auto scale = sahBucketCount / (centroidBounds.max()[dim] - cMin);
+
+      for (const auto& r : refs)
+      {
+        auto b = sahBucketIndex(r.centroid[dim], cMin, scale);
+        (b <= objectSplit.bucket ? left : right).push_back(r);
+      }
+    }
+    if (left.empty() || right.empty())
+      return makeLeaf();
+  }
+  PrimitiveInfoArray{}.swap(refs);
+
+  // The remaining budget is shared by the children in proportion to
+  // their number of references
+  auto nl = uint32_t(left.size());
+  auto nr = uint32_t(right.size());
+  auto duplicates = nl + nr - count;
+
+  budget = budget > duplicates ? budget - duplicates : 0;
+
+  auto leftBudget = uint32_t(uint64_t(budget) * nl / (nl + nr));
+  auto rightBudget = budget - leftBudget;
+
+  // As in makeNode, but leaves of the second subtree built concurrently
+  // are shifted when appended to the references of the first one
+  if (depth < _maxTaskDepth && nr >= parallelBuildThreshold)
+  {
+    NodeArray secondNodes;
+    PrimitiveInfoArray secondRefs;
+    auto task = std::async(std::launch::async, [&]()
+    {
+      makeSpatialNode(secondNodes,
+        secondRefs,
+        std::move(right),
+        depth + 1,
+        rightBudget);
+    });
+
+    makeSpatialNode(nodes, leafRefs, std::move(left), depth + 1, leftBudget);
+    task.get();
+
+    auto secondChild = uint32_t(nodes.size());
+    auto firstRef = uint32_t(leafRefs.size());
+
+    for (auto& node : secondNodes)
+      if (node.isLeaf())
+        node._offset += firstRef;
+    nodes.insert(nodes.end(), secondNodes.begin(), secondNodes.end());
+    leafRefs.insert(leafRefs.end(), secondRefs.begin(), secondRefs.end());
+    nodes[index].setInterior(secondChild - index, dim);
+  }
+  else
+  {
+    makeSpatialNode(nodes, leafRefs, std::move(left), depth + 1, leftBudget);
+
+    auto secondChild = makeSpatialNode(nodes,
+      leafRefs,
+      std::move(right),
+      depth + 1,
+      rightBudget);
+
+    nodes[index].setInterior(secondChild - index, dim);
+  }
+  return index;
+}
+
+void
+BVHBase::build(PrimitiveInfoArray& primitiveInfo)
+{
+  static_assert(sizeof(Node) == 32, "BVHBase: unexpected node size");
+
+  _primitiveCount = uint32_t(primitiveInfo.size());
+  _nodes.clear();
+  Builder{*this, primitiveInfo}.build(_nodes);
+  _nodes.shrink_to_fit();
+
+  // Leaves refer to ranges of the partitioned primitive info array,
+  // which has duplicated primitives if the BVH has spatial splits
+  auto np = uint32_t(primitiveInfo.size());
+  IndexArray orderedPrimitiveIds(np);
+
+  parallelFor(np, [&](uint32_t i)
+  {
+    orderedPrimitiveIds[i] = _primitiveIds[primitiveInfo[i].index];
+  });
+  _primitiveIds.swap(orderedPrimitiveIds);
+  makeWideNodes();
+  _buildCost = sahCost();
+}
+
+void
+BVHBase::rebuild()
+{
+  // The primitive ids may have duplicates, so start over from the
+  // ids 0..n-1 given by the derived classes
+  auto np = _primitiveCount;
+  PrimitiveInfoArray primitiveInfo(np);
+
+  _primitiveIds.resize(np);
+  parallelFor(np, [&](uint32_t i)
+  {
+    primitiveInfo[i] = {_primitiveIds[i] = i, primitiveBounds(i)};
+  });
+  build(primitiveInfo);
+}
+
+void
+BVHBase::splitPrimitive(uint32_t id,
+  int dim,
+  float position,
+  Bounds3f& left,
+  Bounds3f& right) const
+{
+  auto bounds = primitiveBounds(id);
+  auto p1 = bounds.min();
+  auto p2 = bounds.max();
+
+  assert(p1[dim] <= position && position <= p2[dim]);
+  left = right = bounds;
+  p2[dim] = p1[dim] = position;
+  left.set(bounds.min(), p2);
+  right.set(p1, bounds.max());
+}
+
+bool
+BVHBase::traverse(const Node* node, const NodeRay& r) const
+{
+  const Node* stack[maxDepth];
+  auto top = 0;
+
+  for (;;)
+  {
+    BVH_COUNT(nodesVisited, 1);
+    BVH_COUNT(boxesTested, 1);
+    if (node->intersect(r))
+    {
+      if (node->isLeaf())
+      {
+        BVH_COUNT(primitivesTested, node->_count);
+        if (intersectLeaf(node->_offset, node->_count, r))
+          return true;
+      }
+      else
+      {
+        auto near = r.isNegDir[node->_axis];
+
+        stack[top++] = node->child(1 - near);
+        node = node->child(near);
+        continue;
+      }
+    }
+    if (top == 0)
+      return false;
+    node = stack[--top];
+  }
+}
+
+void
+BVHBase::traverse(const Node* node, NodeRay& r, Intersection& hit) const
+{
+  const Node* stack[maxDepth];
+  auto top = 0;
+
+  for (;;)
+  {
+    BVH_COUNT(nodesVisited, 1);
+    BVH_COUNT(boxesTested, 1);
+    if (node->intersect(r))
+    {
+      if (node->isLeaf())
+      {
+        // Nodes and primitives beyond the closest hit found so far
+        // are culled by shrinking the ray interval
+        BVH_COUNT(primitivesTested, node->_count);
+        intersectLeaf(node->_offset, node->_count, r, hit);
+        r.tMax = hit.distance;
+      }
+      else
+      {
+        // Visit the near child first and postpone the far one
+        auto near = r.isNegDir[node->_axis];
+
+        stack[top++] = node->child(1 - near);
+        node = node->child(near);
+        continue;
+      }
+    }
+    if (top == 0)
+      return;
+    node = stack[--top];
+  }
+}
+
+bool
+BVHBase::intersect(const Ray3f& ray) const
+{
+  BVH_COUNT(rays, 1);
+  if (_nodes.empty())
+    return false;
+  if (_width != 2)
+    return intersectWide(ray);
+  return traverse(_nodes.data(), NodeRay{ray});
+}
+
+bool
+BVHBase::intersect(const Ray3f& ray, Intersection& hit) const
+{
+  hit.object = nullptr;
+  hit.distance = ray.tMax;
+  BVH_COUNT(rays, 1);
+  if (_nodes.empty())
+    return false;
+  if (_width != 2)
+    return intersectWide(ray, hit);
+
+  NodeRay r{ray};
+
+  traverse(_nodes.data(), r, hit);
+  return hit.object != nullptr;
+}
+
+BVHBase::RayMask
+BVHBase::intersect(std::span<const Ray3f> rays) const
+{
+  if (_nodes.empty() || rays.empty())
+    return 0;
+
+  RayPacket p{rays};
+  RayMask hitMask{};
+
+  if (_width != 2 || !p.coherent)
+  {
+    for (uint32_t i = 0; i < p.size; ++i)
+      if (intersect(rays[i]))
+        hitMask |= RayMask{1} << i;
+    return hitMask;
+  }
+  BVH_COUNT(rays, p.size);
+
+  struct StackEntry
+  {
+    const Node* node;
+    RayMask mask;
+
+  } stack[maxDepth];
+  auto top = 0;
+  auto node = _nodes.data();
+  auto mask = p.mask;
+
+  for (;;)
+  {
+    // Rays already known to be occluded are discarded
+    mask &= ~hitMask;
+    BVH_COUNT(nodesVisited, 1);
+    BVH_COUNT(boxesTested, std::popcount(mask));
+
+    auto active = p.intersect(node, mask);
+
+    if (std::has_single_bit(active))
+    {
+      auto i = std::countr_zero(active);
+
+      if (traverse(node, NodeRay{p.rays[i]}))
+        hitMask |= active;
+    }
+    else if (active != 0)
+    {
+      if (node->isLeaf())
+      {
+        BVH_COUNT(primitivesTested, node->_count * std::popcount(active));
+        hitMask |= intersectLeaf(node->_offset,
+          node->_count,
+          p.rays,
+          active);
+        if (hitMask == p.mask)
+          break;
+      }
+      else
+      {
+        auto near = p.isNegDir[node->_axis];
+
+        stack[top++] = {node->child(1 - near), active};
+        node = node->child(near);
+        mask = active;
+        continue;
+      }
+    }
+    if (top == 0)
+      break;
+    --top;
+    node = stack[top].node;
+    mask = stack[top].mask;
+  }
+  return hitMask;
+}
+
+BVHBase::RayMask
+BVHBase::intersect(std::span<const Ray3f> rays,
+  std::span<Intersection> hits) const
+{
+  assert(hits.size() >= rays.size());
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    hits[i].object = nullptr;
+    hits[i].distance = rays[i].tMax;
+  }
+  if (_nodes.empty() || rays.empty())
+    return 0;
+
+  RayPacket p{rays};
+  RayMask hitMask{};
+
+  if (_width != 2 || !p.coherent)
+  {
+    for (uint32_t i = 0; i < p.size; ++i)
+      if (intersect(rays[i], hits[i]))
+        hitMask |= RayMask{1} << i;
+    return hitMask;
+  }
+  BVH_COUNT(rays, p.size);
+
+  struct StackEntry
+  {
+    const Node* node;
+    RayMask mask;
+
+  } stack[maxDepth];
+  auto top = 0;
+  auto node = _nodes.data();
+  auto mask = p.mask;
+
+  for (;;)
+  {
+    BVH_COUNT(nodesVisited, 1);
+    BVH_COUNT(boxesTested, std::popcount(mask));
+
+    auto active = p.intersect(node, mask);
+
+    if (std::has_single_bit(active))
+    {
+      auto i = std::countr_zero(active);
+      NodeRay r{p.rays[i]};
+
+      traverse(node, r, hits[i]);
+      p.rays[i].tMax = hits[i].distance;
+    }
+    else if (active != 0)
+    {
+      if (node->isLeaf())
+      {
+        // The interval of every active ray is shrunk to its closest
+        // hit found so far
+        BVH_COUNT(primitivesTested, node->_count * std::popcount(active));
+        intersectLeaf(node->_offset,
+          node->_count,
+          p.rays,
+          active,
+          hits.data());
+        for (; active != 0; active &= active - 1)
+        {
+          auto i = std::countr_zero(active);
+          p.rays[i].tMax = hits[i].distance;
+        }
+      }
+      else
+      {
+        auto near = p.isNegDir[node->_axis];
+
+        stack[top++] = {node->child(1 - near), active};
+        node = node->child(near);
+        mask = active;
+        continue;
+      }
+    }
+    if (top == 0)
+      break;
+    --top;
+    node = stack[top].node;
+    mask = stack[top].mask;
+  }
+  for (uint32_t i = 0; i < p.size; ++i)
+    if (hits[i].object != nullptr)
+      hitMask |= RayMask{1} << i;
+  return hitMask;
+}
+
+BVHBase::RayMask
+BVHBase::intersectLeaf(uint32_t first,
+  uint32_t count,
+  const Ray3f* rays,
+  RayMask mask) const
+{
+  RayMask hitMask{};
+
+  for (; mask != 0; mask &= mask - 1)
+  {
+    auto i = std::countr_zero(mask);
+
+    if (intersectLeaf(first, count, rays[i]))
+      hitMask |= RayMask{1} << i;
+  }
+  return hitMask;
+}
+
+void
+BVHBase::intersectLeaf(uint32_t first,
+  uint32_t count,
+  const Ray3f* rays,
+  RayMask mask,
+  Intersection* hits) const
+{
+  for (; mask != 0; mask &= mask - 1)
+  {
+    auto i = std::countr_zero(mask);
+    intersectLeaf(first, count, rays[i], hits[i]);
+  }
+}
+
+namespace
+{ // begin namespace
+
+inline float
+squaredDistance(const Bounds3f& b, const vec3f& p)
+{
+  auto d = 0.0f;
+
+  for (int k = 0; k < 3; ++k)
+  {
+    auto x = std::max({b.min()[k] - p[k], p[k] - b.max()[k], 0.0f});
+    d += x * x;
+  }
+  return d;
+}
+
+struct NodeDistance
+{
+  uint32_t index;
+  float distance; // squared distance to the query point
+
+  // Heap order, with the nearest node on top
+  bool operator <(const NodeDistance& other) const
+  {
+    return distance > other.distance;
+  }
+
+}; // NodeDistance
+
+} // end namespace
+
+bool
+BVHBase::canFindClosestPoints() const
+{
+  return false;
+}
+
+BVHBase::ClosestPoint
+BVHBase::closestPoint(const vec3f& p, float maxDistance) const
+{
+  if (!canFindClosestPoints())
+    throw std::logic_error("BVH: closest point queries not supported");
+
+  ClosestPoint c;
+
+  c.distance = maxDistance;
+  if (_nodes.empty())
+    return c;
+
+  // The heap of nodes to visit is kept between queries of a thread,
+  // so that queries do not allocate memory
+  thread_local std::vector<NodeDistance> heap;
+
+  heap.clear();
+  heap.push_back({0, squaredDistance(_nodes[0]._bounds, p)});
+  while (!heap.empty())
+  {
+    std::pop_heap(heap.begin(), heap.end());
+
+    auto [index, d2] = heap.back();
+
+    heap.pop_back();
+    // The remaining nodes are not closer than the closest point
+    if (d2 > c.distance * c.distance)
+      break;
+
+    const auto& node = _nodes[index];
+
+    if (node.isLeaf())
+    {
+      closestPointLeaf(node._offset, node._count, p, c);
+      continue;
+    }
+    for (auto child : {index + 1, index + node._offset})
+      if (auto cd2 = squaredDistance(_nodes[child]._bounds, p);
+        cd2 <= c.distance * c.distance)
+      {
+        heap.push_back({child, cd2});
+        std::push_heap(heap.begin(), heap.end());
+      }
+  }
+  return c;
+}
+
+void
+BVHBase::closestPoints(std::span<const vec3f> points,
+  float maxDistance,
+  std::span<ClosestPoint> results) const
+{
+  assert(results.size() >= points.size());
+  // Checked here since an exception thrown by a worker thread would
+  // terminate the program
+  if (!canFindClosestPoints())
+    throw std::logic_error("BVH: closest point queries not supported");
+  parallelFor(uint32_t(points.size()), [&](uint32_t i)
+  {
+    results[i] = closestPoint(points[i], maxDistance);
+  }, 64);
+}
+
+void
+BVHBase::closestPointLeaf(uint32_t,
+  uint32_t,
+  const vec3f&,
+  ClosestPoint&) const
+{
+  // do nothing
+}
+
+namespace
+{ // begin namespace
+
+// Transforms boxes by an affine matrix (Arvo): the center of a box is
+// transformed, and its half size is multiplied by the absolute values
+// of the elements of the 3x3 part of the matrix
+class BoundsTransform
+{
+public:
+  BoundsTransform(const mat4f& m):
+    _m{m}
+  {
+    for (int i = 0; i < 3; ++i)
+      for (int j = 0; j < 3; ++j)
+        _a[i][j] = std::abs(m(i, j));
+  }
+
+  Bounds3f operator ()(const Bounds3f& b) const
+  {
+    auto c = _m.transform3x4(b.center());
+    auto h = b.size() * 0.5f;
+    vec3f e;
+
+    for (int i = 0; i < 3; ++i)
+      e[i] = _a[i][0] * h.x + _a[i][1] * h.y + _a[i][2] * h.z;
+    return {c - e, c + e};
+  }
+
+private:
+  mat4f _m;
+  float _a[3][3];
+
+}; // BoundsTransform
+
+} // end namespace
+
+void
+BVHBase::overlap(const BVHBase& other,
+  const mat4f& m,
+  std::vector<LeafPair>& pairs) const
+{
+  findLeafPairs(other, m, false, pairs);
+}
+
+void
+BVHBase::selfOverlap(std::vector<LeafPair>& pairs) const
+{
+  findLeafPairs(*this, mat4f::identity(), true, pairs);
+}
+
+void
+BVHBase::findLeafPairs(const BVHBase& other,
+  const mat4f& m,
+  bool self,
+  std::vector<LeafPair>& pairs) const
+{
+  pairs.clear();
+  if (_nodes.empty() || other._nodes.empty())
+    return;
+
+  using NodePair = std::pair<const Node*, const Node*>;
+
+  BoundsTransform transform{m};
+  // Visits a pair of nodes: reports it if both nodes are overlapping
+  // leaves, or pushes the pairs of their children to be visited. The
+  // node with the larger bounds is split first
+  auto visit = [&](const NodePair& p, auto&& report, auto&& push)
+  {
+    auto [a, b] = p;
+
+    if (self && a == b)
+    {
+      if (a->isLeaf())
+        report(a, b);
+      else
+      {
+        push({a->child(0), b->child(0)});
+        push({a->child(1), b->child(1)});
+        push({a->child(0), b->child(1)});
+      }
+      return;
+    }
+
+    auto bounds = transform(b->_bounds);
+
+    if (!a->_bounds.intersect(bounds))
+      return;
+    if (a->isLeaf() && b->isLeaf())
+      report(a, b);
+    else if (b->isLeaf() ||
+      (!a->isLeaf() && a->_bounds.area() >= bounds.area()))
+    {
+      push({a->child(0), b});
+      push({a->child(1), b});
+    }
+    else
+    {
+      push({a, b->child(0)});
+      push({a, b->child(1)});
+    }
+  };
+  auto report = [](std::vector<LeafPair>& pairs)
+  {
+    return [&pairs](const Node* a, const Node* b)
+    {
+      pairs.push_back({a->_offset, a->_count, b->_offset, b->_count});
+    };
+  };
+  // The pairs are first expanded breadth-first into enough subtrees
+  // to keep all threads busy
+  const auto minTaskCount = 16 * hardwareThreadCount();
+  std::vector<NodePair> tasks{{_nodes.data(), other._nodes.data()}};
+  std::vector<NodePair> next;
+
+  while (!tasks.empty() && tasks.size() < minTaskCount)
+  {
+    next.clear();
+    for (const auto& p : tasks)
+      visit(p, report(pairs), [&next](const NodePair& p)
+      {
+        next.push_back(p);
+      });
+    tasks.swap(next);
+  }
+
+  std::vector<std::vector<LeafPair>> taskPairs(tasks.size());
+
+  parallelFor(uint32_t(tasks.size()), [&](uint32_t i)
+  {
+    // A visit pushes at most three pairs one level deeper in one of
+    // the trees, which bounds the size of the stack
+    NodePair stack[4 * maxDepth + 4];
+    uint32_t top{};
+
+    stack[top++] = tasks[i];
+    while (top > 0)
+      visit(stack[--top], report(taskPairs[i]), [&](const NodePair& p)
+      {
+        stack[top++] = p;
+      });
+  }, 1);
+  for (const auto& p : taskPairs)
+    pairs.insert(pairs.end(), p.begin(), p.end());
+}
+
+Bounds3f
+BVHBase::bounds() const
+{
+  return _nodes.empty() ? Bounds3f{} : _nodes[0]._bounds;
+}
+
+void
+BVHBase::iterate(NodeFunction f) const
+{
+  // Nodes are visited in depth-first order
+  for (const auto& node : _nodes)
+    f(&node);
+}
+
+namespace
+{ // begin namespace
+
+// BVH files start with this header, which is followed by the nodes
+// and the primitive ids of the leaves (references), which can outnumber
+// the primitives in spatial split BVHs. Files of a different version
+// are discarded
+struct BVHFileHeader
+{
+  char magic[6];
+  uint16_t version;
+  uint32_t maxPrimitivesPerNode;
+  uint32_t splitMethod;
+  uint32_t nodeCount;
+  uint32_t primitiveCount;
+  uint32_t referenceCount;
+  uint32_t reserved;
+  uint64_t key;
+  uint64_t checksum; // hash of the nodes and primitive ids
+
+}; // BVHFileHeader
+
+constexpr char bvhFileMagic[6] = "CGBVH";
+constexpr uint16_t bvhFileVersion = 2;
+
+} // end namespace
+
+uint64_t
+BVHBase::hash(const void* data, size_t size, uint64_t h)
+{
+  // FNV-1a over 64-bit words, with the high bits of the hash folded
+  // into the low ones after each word
+  constexpr auto prime = 1099511628211ull;
+  auto p = static_cast<const uint8_t*>(data);
+
+  for (; size >= 8; size -= 8, p += 8)
+  {
+    uint64_t w;
+
+    memcpy(&w, p, 8);
+    h = (h ^ w) * prime;
+    h ^= h >> 29;
+  }
+  for (; size > 0; --size)
+    h = (h ^ *p++) * prime;
+  return h;
+}
+
+bool
+BVHBase::write(FILE* file, uint64_t key) const
+{
+  BVHFileHeader header;
+  auto nodeCount = _nodes.size();
+  auto referenceCount = _primitiveIds.size();
+  auto nodeSize = nodeCount * sizeof(Node);
+  auto idSize = referenceCount * sizeof(uint32_t);
+
+  memcpy(header.magic, bvhFileMagic, sizeof header.magic);
+  header.version = bvhFileVersion;
+  header.maxPrimitivesPerNode = _maxPrimitivesPerNode;
+  header.splitMethod = uint32_t(_splitMethod);
+  header.nodeCount = uint32_t(nodeCount);
+  header.primitiveCount = _primitiveCount;
+  header.referenceCount = uint32_t(referenceCount);
+  header.reserved = 0;
+  header.key = key;
+  header.checksum = hash(_primitiveIds.data(),
+    idSize,
+    hash(_nodes.data(), nodeSize));
+  return fwrite(&header, sizeof header, 1, file) == 1 &&
+    fwrite(_nodes.data(), sizeof(Node), nodeCount, file) == nodeCount &&
+    fwrite(_primitiveIds.data(), 4, referenceCount, file) == referenceCount;
+}
+
+bool
+BVHBase::read(FILE* file, uint64_t key, uint32_t primitiveCount)
+{
+  BVHFileHeader header;
+
+  if (fread(&header, sizeof header, 1, file) != 1 ||
+    memcmp(header.magic, bvhFileMagic, sizeof header.magic) != 0 ||
+    header.version != bvhFileVersion ||
+    header.key != key ||
+    header.maxPrimitivesPerNode != _maxPrimitivesPerNode ||
+    header.splitMethod != uint32_t(_splitMethod) ||
+    header.primitiveCount != primitiveCount ||
+    header.referenceCount < primitiveCount ||
+    header.referenceCount > 2 * uint64_t(primitiveCount) ||
+    header.nodeCount == 0 ||
+    header.nodeCount >= 2 * uint64_t(header.referenceCount))
+    return false;
+
+  // The nodes and primitive ids are read into their arrays at once
+  auto nodeCount = header.nodeCount;
+  auto referenceCount = header.referenceCount;
+  NodeArray nodes(nodeCount);
+  IndexArray primitiveIds(referenceCount);
+
+  if (fread(nodes.data(), sizeof(Node), nodeCount, file) != nodeCount ||
+    fread(primitiveIds.data(), 4, referenceCount, file) != referenceCount)
+    return false;
+  if (hash(primitiveIds.data(),
+    referenceCount * sizeof(uint32_t),
+    hash(nodes.data(), nodeCount * sizeof(Node))) != header.checksum)
+    return false;
+  for (auto id : primitiveIds)
+    if (id >= primitiveCount)
+      return false;
+
+  // Check that every node is the child of exactly one node preceding
+  // it, and that the depth of the tree does not overflow the stacks
+  // of the traversals
+  std::vector<uint8_t> depth(nodeCount);
+
+  depth[0] = 1;
+  for (uint32_t i = 0; i < nodeCount; ++i)
+  {
+    const auto& node = nodes[i];
+
+    if (depth[i] == 0)
+      return false;
+    if (node.isLeaf())
+    {
+      if (uint64_t(node._offset) + node._count > referenceCount)
+        return false;
+    }
+    else
+    {
+      auto j = i + node._offset;
+
+      // The split axis indexes the direction signs in the traversals
+      if (node._axis > 2 || node._offset < 2 || node._offset >= nodeCount - i ||
+        depth[i + 1] != 0 || depth[j] != 0 || depth[i] >= maxDepth)
+        return false;
+      depth[i + 1] = depth[j] = depth[i] + 1;
+    }
+  }
+  _nodes.swap(nodes);
+  _primitiveIds.swap(primitiveIds);
+  _primitiveCount = primitiveCount;
+  makeWideNodes();
+  _buildCost = sahCost();
+  return true;
+}
+
+float
+BVHBase::sahCost() const
+{
+  if (_nodes.empty())
+    return 0;
+
+  auto cost = 0.0f;
+
+  for (const auto& node : _nodes)
+  {
+    auto area = node._bounds.area();
+    cost += node.isLeaf() ? area * node._count : area * sahTraversalCost;
+  }
+
+  auto rootArea = _nodes[0]._bounds.area();
+  return rootArea > 0 ? cost / rootArea : 0;
+}
+
+inline size_t
+BVHBase::nodeMemory() const
+{
+  return _nodes.size() * sizeof(Node) +
+    _wideNodes4.size() * sizeof(WideNode<4>) +
+    _wideNodes8.size() * sizeof(WideNode<8>) +
+    _wideNodes4Q8.size() * sizeof(QuantizedNode<4, uint8_t>) +
+    _wideNodes4Q16.size() * sizeof(QuantizedNode<4, uint16_t>) +
+    _wideNodes8Q8.size() * sizeof(QuantizedNode<8, uint8_t>) +
+    _wideNodes8Q16.size() * sizeof(QuantizedNode<8, uint16_t>);
+}
+
+BVHBase::Statistics
+BVHBase::statistics() const
+{
+  Statistics s{};
+
+  s.sahCost = sahCost();
+  s.nodeCount = uint32_t(_nodes.size());
+  s.primitiveCount = _primitiveCount;
+  s.referenceCount = uint32_t(_primitiveIds.size());
+  s.nodeMemory = nodeMemory();
+  s.indexMemory = _primitiveIds.size() * sizeof(uint32_t);
+  s.leafDataMemory = leafDataMemory();
+  if (_nodes.empty())
+    return s;
+
+  // Nodes are in depth-first order, so the depth of a node is known
+  // before the node is visited
+  std::vector<uint8_t> depth(_nodes.size());
+  auto depthSum = 0.0;
+  auto interiorCount = 0u;
+
+  for (uint32_t i = 0; i < s.nodeCount; ++i)
+  {
+    const auto& node = _nodes[i];
+    uint32_t d = depth[i];
+
+    if (node.isLeaf())
+    {
+      if (d >= s.depthHistogram.size())
+        s.depthHistogram.resize(d + 1);
+      ++s.depthHistogram[d];
+      if (node._count >= s.leafSizeHistogram.size())
+        s.leafSizeHistogram.resize(node._count + 1);
+      ++s.leafSizeHistogram[node._count];
+      ++s.leafCount;
+      s.maxDepth = std::max(s.maxDepth, d);
+      depthSum += d;
+      continue;
+    }
+    depth[i + 1] = depth[i + node._offset] = uint8_t(d + 1);
+
+    auto overlap = intersection(node.child(0)->_bounds,
+      node.child(1)->_bounds);
+
+    if (!isEmpty(overlap))
+    {
+      auto area = overlap.area();
+
+      s.overlap += area;
+      if (auto nodeArea = node._bounds.area(); nodeArea > 0)
+        s.averageOverlap += area / nodeArea;
+    }
+    ++interiorCount;
+  }
+  s.averageLeafDepth = float(depthSum / s.leafCount);
+  if (auto rootArea = _nodes[0]._bounds.area(); rootArea > 0)
+    s.overlap /= rootArea;
+  if (interiorCount > 0)
+    s.averageOverlap /= interiorCount;
+  return s;
+}
+
+size_t
+BVHBase::memorySize() const
+{
+  return nodeMemory() +
+    _primitiveIds.size() * sizeof(uint32_t) +
+    leafDataMemory();
+}
+
+namespace
+{ // begin namespace
+
+void
+writeJSONArray(FILE* f, const char* name, const std::vector<uint32_t>& a)
+{
+  fprintf(f, "  \"%s\": [", name);
+  for (size_t i = 0; i < a.size(); ++i)
+    fprintf(f, i > 0 ? ", %u" : "%u", a[i]);
+  fputc(']', f);
+}
+
+} // end namespace
+
+void
+BVHBase::Statistics::writeJSON(FILE* f) const
+{
+  fprintf(f, "{\n");
+  fprintf(f, "  \"nodeCount\": %u,\n", nodeCount);
+  fprintf(f, "  \"leafCount\": %u,\n", leafCount);
+  fprintf(f, "  \"primitiveCount\": %u,\n", primitiveCount);
+  fprintf(f, "  \"referenceCount\": %u,\n", referenceCount);
+  fprintf(f, "  \"maxDepth\": %u,\n", maxDepth);
+  fprintf(f, "  \"averageLeafDepth\": %g,\n", averageLeafDepth);
+  fprintf(f, "  \"sahCost\": %g,\n", sahCost);
+  fprintf(f, "  \"overlap\": %g,\n", overlap);
+  fprintf(f, "  \"averageOverlap\": %g,\n", averageOverlap);
+  fprintf(f, "  \"nodeMemory\": %zu,\n", nodeMemory);
+  fprintf(f, "  \"indexMemory\": %zu,\n", indexMemory);
+  fprintf(f, "  \"leafDataMemory\": %zu,\n", leafDataMemory);
+  writeJSONArray(f, "depthHistogram", depthHistogram);
+  fprintf(f, ",\n");
+  writeJSONArray(f, "leafSizeHistogram", leafSizeHistogram);
+  fprintf(f, "\n}\n");
+}
+
+BVHBase::QueryCounters&
+BVHBase::QueryCounters::operator +=(const QueryCounters& other)
+{
+  rays += other.rays;
+  nodesVisited += other.nodesVisited;
+  boxesTested += other.boxesTested;
+  primitivesTested += other.primitivesTested;
+  return *this;
+}
+
+void
+BVHBase::QueryCounters::writeJSON(FILE* f) const
+{
+  fprintf(f, "{\n");
+  fprintf(f, "  \"rays\": %" PRIu64 ",\n", rays);
+  fprintf(f, "  \"nodesVisited\": %" PRIu64 ",\n", nodesVisited);
+  fprintf(f, "  \"boxesTested\": %" PRIu64 ",\n", boxesTested);
+  fprintf(f, "  \"primitivesTested\": %" PRIu64 "\n", primitivesTested);
+  fprintf(f, "}\n");
+}
+
+BVHBase::QueryCounters&
+BVHBase::queryCounters()
+{
+  return threadQueryCounters;
+}
+
+bool
+BVHBase::refit(float maxCostRatio)
+{
+  if (_nodes.empty())
+    return false;
+
+  auto nodeCount = uint32_t(_nodes.size());
+  auto nodes = _nodes.data();
+
+  // Leaves are independent of each other. Since the children of a
+  // node follow it in the array, visiting the interior nodes in
+  // reverse order updates every child before its parent
+  parallelFor(nodeCount, [&](uint32_t i)
+  {
+    auto& node = nodes[i];
+
+    if (node.isLeaf())
+    {
+      Bounds3f bounds;
+
+      for (auto p = node._offset, e = p + node._count; p < e; ++p)
+        bounds.inflate(primitiveBounds(_primitiveIds[p]));
+      node._bounds = bounds;
+    }
+  }, 256);
+  for (auto i = nodeCount; i-- > 0;)
+    if (!nodes[i].isLeaf())
+      nodes[i].setInterior(nodes[i]._offset, nodes[i]._axis);
+  if (maxCostRatio > 0 && sahCost() > maxCostRatio * _buildCost)
+  {
+    rebuild();
+    return true;
+  }
+  makeWideNodes();
+  return false;
+}
+
+namespace
+{ // begin namespace
+
+class WideRay: public Ray3f
+{
+public:
+  explicit WideRay(const Ray3f& r):
+    Ray3f{r}
+  {
+    invDir = r.direction.inverse();
+    for (int i = 0; i < 3; ++i)
+    {
+      auto isNegDir = r.direction[i] < 0;
+
+      nearPlane[i] = isNegDir ? i + 3 : i;
+      farPlane[i] = isNegDir ? i : i + 3;
+    }
+  }
+
+  vec3f invDir;
+  int nearPlane[3];
+  int farPlane[3];
+
+}; // WideRay
+
+template <int N>
+inline uint32_t
+intersectChildren(const float (&bounds)[6][N],
+  const WideRay& r,
+  float* tNear)
+{
+  uint32_t mask{};
+
+  for (int i = 0; i < N; ++i)
+  {
+    auto tMin = r.tMin;
+    auto tMax = r.tMax;
+
+    for (int k = 0; k < 3; ++k)
+    {
+      auto t0 = (bounds[r.nearPlane[k]][i] - r.origin[k]) * r.invDir[k];
+      auto t1 = (bounds[r.farPlane[k]][i] - r.origin[k]) * r.invDir[k];
+
+      if (t0 > tMin)
+        tMin = t0;
+      if (t1 < tMax)
+        tMax = t1;
+    }
+    tNear[i] = tMin;
+    if (tMin <= tMax)
+      mask |= 1 << i;
+  }
+  return mask;
+}
+
+#ifdef BVH_USE_SSE
+template <>
+inline uint32_t
+intersectChildren<4>(const float (&bounds)[6][4],
+  const WideRay& r,
+  float* tNear)
+{
+  auto tMin = _mm_set1_ps(r.tMin);
+  auto tMax = _mm_set1_ps(r.tMax);
+
+  for (int k = 0; k < 3; ++k)
+  {
+    auto o = _mm_set1_ps(r.origin[k]);
+    auto d = _mm_set1_ps(r.invDir[k]);
+    auto b0 = _mm_loadu_ps(bounds[r.nearPlane[k]]);
+    auto b1 = _mm_loadu_ps(bounds[r.farPlane[k]]);
+
+    // NaNs (0 * inf) are discarded as in the scalar test, since
+    // min and max return their second operand if any is a NaN
+    tMin = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(b0, o), d), tMin);
+    tMax = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(b1, o), d), tMax);
+  }
+  _mm_storeu_ps(tNear, tMin);
+  return _mm_movemask_ps(_mm_cmple_ps(tMin, tMax));
+}
+#endif // BVH_USE_SSE
+
+#ifdef BVH_USE_AVX
+template <>
+inline uint32_t
+intersectChildren<8>(const float (&bounds)[6][8],
+  const WideRay& r,
+  float* tNear)
+{
+  auto tMin = _mm256_set1_ps(r.tMin);
+  auto tMax = _mm256_set1_ps(r.tMax);
+
+  for (int k = 0; k < 3; ++k)
+  {
+    auto o = _mm256_set1_ps(r.origin[k]);
+    auto d = _mm256_set1_ps(r.invDir[k]);
+    auto b0 = _mm256_loadu_ps(bounds[r.nearPlane[k]]);
+    auto b1 = _mm256_loadu_ps(bounds[r.farPlane[k]]);
+
+    tMin = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(b0, o), d), tMin);
+    tMax = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(b1, o), d), tMax);
+  }
+  _mm256_storeu_ps(tNear, tMin);
+  return _mm256_movemask_ps(_mm256_cmp_ps(tMin, tMax, _CMP_LE_OQ));
+}
+#endif // BVH_USE_AVX
+
+// Decodes the coordinates of N children of a quantized node
+template <int N, typename Q>
+inline void
+decodeChildren(const Q* q, float origin, float scale, float* x)
+{
+  for (int i = 0; i < N; ++i)
+    x[i] = origin + float(q[i]) * scale;
+}
+
+#ifdef BVH_USE_SSE
+inline void
+decodeChildren(__m128i q, float origin, float scale, float* x)
+{
+  auto o = _mm_set1_ps(origin);
+  auto s = _mm_set1_ps(scale);
+
+  _mm_storeu_ps(x, _mm_add_ps(o, _mm_mul_ps(_mm_cvtepi32_ps(q), s)));
+}
+
+template <>
+inline void
+decodeChildren<4, uint8_t>(const uint8_t* q,
+  float origin,
+  float scale,
+  float* x)
+{
+  int32_t bytes;
+
+  std::memcpy(&bytes, q, 4);
+
+  auto zero = _mm_setzero_si128();
+  auto v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+
+  decodeChildren(_mm_unpacklo_epi16(v, zero), origin, scale, x);
+}
+
+template <>
+inline void
+decodeChildren<4, uint16_t>(const uint16_t* q,
+  float origin,
+  float scale,
+  float* x)
+{
+  auto v = _mm_loadl_epi64((const __m128i*)q);
+
+  decodeChildren(_mm_unpacklo_epi16(v, _mm_setzero_si128()),
+    origin,
+    scale,
+    x);
+}
+#endif // BVH_USE_SSE
+
+#ifdef BVH_USE_AVX
+inline void
+decodeChildren(__m256i q, float origin, float scale, float* x)
+{
+  auto o = _mm256_set1_ps(origin);
+  auto s = _mm256_set1_ps(scale);
+
+  _mm256_storeu_ps(x,
+    _mm256_add_ps(o, _mm256_mul_ps(_mm256_cvtepi32_ps(q), s)));
+}
+
+template <>
+inline void
+decodeChildren<8, uint8_t>(const uint8_t* q,
+  float origin,
+  float scale,
+  float* x)
+{
+  auto v = _mm_loadl_epi64((const __m128i*)q);
+
+  decodeChildren(_mm256_cvtepu8_epi32(v), origin, scale, x);
+}
+
+template <>
+inline void
+decodeChildren<8, uint16_t>(const uint16_t* q,
+  float origin,
+  float scale,
+  float* x)
+{
+  auto v = _mm_loadu_si128((const __m128i*)q);
+
+  decodeChildren(_mm256_cvtepu16_epi32(v), origin, scale, x);
+}
+#endif // BVH_USE_AVX
+
+struct WideStackEntry
+{
+  uint32_t offset;
+  uint32_t count;
+  float t;
+
+}; // WideStackEntry
+
+} // end namespace
+
+template <int N, typename Q>
+inline const typename BVHBase::QuantizedNode<N, Q>::Bounds&
+BVHBase::QuantizedNode<N, Q>::childBounds(Bounds& bounds) const
+{
+  for (int k = 0; k < 6; ++k)
+    decodeChildren<N>(_bounds[k], _origin[k % 3], _scale[k % 3], bounds[k]);
+  return bounds;
+}
+
+template <int N>
+uint32_t
+BVHBase::collapse(WideNodeArray<N>& wideNodes, const Node* node) const
+{
+  auto index = uint32_t(wideNodes.size());
+  const Node* children[N];
+  auto n = 1;
+
+  wideNodes.emplace_back();
+  children[0] = node;
+  // Replace the interior child with the largest area by its children
+  // until there are N children or all of them are leaves
+  while (n < N)
+  {
+    auto best = -1;
+    auto bestArea = -1.0f;
+
+    for (auto i = 0; i < n; ++i)
+      if (!children[i]->isLeaf() && children[i]->_bounds.area() > bestArea)
+      {
+        best = i;
+        bestArea = children[i]->_bounds.area();
+      }
+    if (best < 0)
+      break;
+
+    auto c = children[best];
+
+    children[best] = c->child(0);
+    children[n++] = c->child(1);
+  }
+  for (auto i = 0; i < n; ++i)
+  {
+    auto c = children[i];
+
+    if (c->isLeaf())
+      wideNodes[index].setChild(i, c->_bounds, c->_offset, c->_count);
+    else
+    {
+      auto child = collapse(wideNodes, c);
+      wideNodes[index].setChild(i, c->_bounds, child, 0);
+    }
+  }
+  return index;
+}
+
+template <int N, typename Q>
+void
+BVHBase::quantize(const WideNodeArray<N>& wideNodes,
+  QuantizedNodeArray<N, Q>& nodes)
+{
+  nodes.clear();
+  nodes.reserve(wideNodes.size());
+  for (const auto& w : wideNodes)
+  {
+    Bounds3f bounds;
+    Bounds3f children[N];
+    auto n = 0;
+
+    // Used children come first and have nonempty bounds
+    for (; n < N && w._bounds[0][n] <= w._bounds[3][n]; ++n)
+    {
+      vec3f p1{w._bounds[0][n], w._bounds[1][n], w._bounds[2][n]};
+      vec3f p2{w._bounds[3][n], w._bounds[4][n], w._bounds[5][n]};
+
+      children[n].set(p1, p2);
+      bounds.inflate(children[n]);
+    }
+
+    auto& node = nodes.emplace_back(bounds);
+
+    for (auto i = 0; i < n; ++i)
+      node.setChild(i, children[i], w._offset[i], w._count[i]);
+  }
+}
+
+template <int N>
+void
+BVHBase::makeWideNodes(WideNodeArray<N>& wideNodes,
+  QuantizedNodeArray<N, uint8_t>& nodes8,
+  QuantizedNodeArray<N, uint16_t>& nodes16)
+{
+  collapse(wideNodes, _nodes.data());
+  if (_nodeFormat == NodeFormat::Full)
+  {
+    wideNodes.shrink_to_fit();
+    return;
+  }
+  if (_nodeFormat == NodeFormat::Quantized8)
+    quantize(wideNodes, nodes8);
+  else
+    quantize(wideNodes, nodes16);
+  WideNodeArray<N>{}.swap(wideNodes);
+}
+
+void
+BVHBase::makeWideNodes()
+{
+  _wideNodes4.clear();
+  _wideNodes8.clear();
+  _wideNodes4Q8.clear();
+  _wideNodes4Q16.clear();
+  _wideNodes8Q8.clear();
+  _wideNodes8Q16.clear();
+  if (_nodes.empty() || _width == 2)
+    return;
+  if (_width == 4)
+    makeWideNodes(_wideNodes4, _wideNodes4Q8, _wideNodes4Q16);
+  else
+    makeWideNodes(_wideNodes8, _wideNodes8Q8, _wideNodes8Q16);
+}
+
+void
+BVHBase::setWidth(uint32_t width)
+{
+  if (width != 2 && width != 4 && width != 8)
+    throw std::logic_error("BVH: bad width");
+  if (width != _width)
+  {
+    _width = width;
+    makeWideNodes();
+  }
+}
+
+void
+BVHBase::setNodeFormat(NodeFormat format)
+{
+  if (format != _nodeFormat)
+  {
+    _nodeFormat = format;
+    makeWideNodes();
+  }
+}
+
+bool
+BVHBase::intersectWide(const Ray3f& ray) const
+{
+  if (_nodeFormat == NodeFormat::Quantized8)
+    return _width == 4 ?
+      intersectWide(_wideNodes4Q8, ray) :
+      intersectWide(_wideNodes8Q8, ray);
+  if (_nodeFormat == NodeFormat::Quantized16)
+    return _width == 4 ?
+      intersectWide(_wideNodes4Q16, ray) :
+      intersectWide(_wideNodes8Q16, ray);
+  return _width == 4 ?
+    intersectWide(_wideNodes4, ray) :
+    intersectWide(_wideNodes8, ray);
+}
+
+bool
+BVHBase::intersectWide(const Ray3f& ray, Intersection& hit) const
+{
+  if (_nodeFormat == NodeFormat::Quantized8)
+    return _width == 4 ?
+      intersectWide(_wideNodes4Q8, ray, hit) :
+      intersectWide(_wideNodes8Q8, ray, hit);
+  if (_nodeFormat == NodeFormat::Quantized16)
+    return _width == 4 ?
+      intersectWide(_wideNodes4Q16, ray, hit) :
+      intersectWide(_wideNodes8Q16, ray, hit);
+  return _width == 4 ?
+    intersectWide(_wideNodes4, ray, hit) :
+    intersectWide(_wideNodes8, ray, hit);
+}
+
+template <typename T>
+bool
+BVHBase::intersectWide(const std::vector<T>& wideNodes,
+  const Ray3f& ray) const
+{
+  constexpr auto N = T::width;
+  constexpr auto stackSize = (N - 1) * maxDepth + 1;
+  WideRay r{ray};
+  WideStackEntry stack[stackSize];
+  auto top = 0;
+
+  stack[top++] = {0, 0, r.tMin};
+  while (top > 0)
+  {
+    auto e = stack[--top];
+
+    BVH_COUNT(nodesVisited, 1);
+    if (e.count > 0)
+    {
+      BVH_COUNT(primitivesTested, e.count);
+      if (intersectLeaf(e.offset, e.count, ray))
+        return true;
+      continue;
+    }
+
+    const auto& node = wideNodes[e.offset];
+    typename T::Bounds bounds;
+    float tNear[N];
+    auto mask = intersectChildren<N>(node.childBounds(bounds), r, tNear) &
+      node.childMask();
+
+    BVH_COUNT(boxesTested, N);
+    for (; mask != 0; mask &= mask - 1)
+    {
+      auto i = std::countr_zero(mask);
+      stack[top++] = {node._offset[i], node._count[i], tNear[i]};
+    }
+  }
+  return false;
+}
+
+template <typename T>
+bool
+BVHBase::intersectWide(const std::vector<T>& wideNodes,
+  const Ray3f& ray,
+  Intersection& hit) const
+{
+  constexpr auto N = T::width;
+  constexpr auto stackSize = (N - 1) * maxDepth + 1;
+  WideRay r{ray};
+  WideStackEntry stack[stackSize];
+  auto top = 0;
+
+  stack[top++] = {0, 0, r.tMin};
+  while (top > 0)
+  {
+    auto e = stack[--top];
+
+    // Skip postponed children beyond the closest hit found so far
+    if (e.t > r.tMax)
+      continue;
+    BVH_COUNT(nodesVisited, 1);
+    if (e.count > 0)
+    {
+      BVH_COUNT(primitivesTested, e.count);
+      intersectLeaf(e.offset, e.count, r, hit);
+      r.tMax = hit.distance;
+      continue;
+    }
+
+    const auto& node = wideNodes[e.offset];
+    typename T::Bounds bounds;
+    float tNear[N];
+    auto mask = intersectChildren<N>(node.childBounds(bounds), r, tNear) &
+      node.childMask();
+    auto base = top;
+
+    BVH_COUNT(boxesTested, N);
+
+    // Push the children hit from the farthest to the nearest one
+    for (; mask != 0; mask &= mask - 1)
+    {
+      auto i = std::countr_zero(mask);
+      WideStackEntry c{node._offset[i], node._count[i], tNear[i]};
+      auto j = top++;
+
+      for (; j > base && stack[j - 1].t < c.t; --j)
+        stack[j] = stack[j - 1];
+      stack[j] = c;
+    }
+  }
+  return hit.object != nullptr;
 }
 
 } // end namespace cg
@@ -28,7 +28,7 @@
 // Source file for simple triangle mesh.
 //
 // Author: Paulo Pagliosa
-// Last revision: 30/07/2023
+// Last revision: 17/10/2026
 
 #include "geometry/MeshSweeper.h"
 #include <cstring>
@@ -100,7 +100,7 @@ TriangleMesh::TRS(const mat4f& trs)
 
   for (int i = 0; i < nv; ++i)
     _data.vertices[i] = trs.transform3x4(_data.vertices[i]);
-  _bounds.setEmpty();
+  verticesChanged();
   if (_data.vertexNormals == nullptr)
     return;
 
@@ -123,6 +123,14 @@ TriangleMesh::normalize()
     *v = (*v - c) * m;
   s *= m * 0.5f;
   _bounds.set(-s, s);
+  ++_vertexStamp;
+}
+
+void
+TriangleMesh::verticesChanged()
+{
+  _bounds.setEmpty();
+  ++_vertexStamp;
 }
 
 static inline void
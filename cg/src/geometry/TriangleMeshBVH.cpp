@@ -28,42 +28,202 @@
 // Source file for triangle mesh BVH.
 //
 // Author: Paulo Pagliosa
-// Last revision: 07/02/2022
+// Last revision: 17/10/2026
 
+#include "core/Parallel.h"
 #include "geometry/TriangleMeshBVH.h"
+#include <algorithm>
+#include <bit>
+
+// SIMD tests of a ray against blocks of 8 (AVX2) or 4 (SSE)
+// triangles, used by the BVHs they are enabled for (define
+// BVH_NO_SIMD for scalar tests only)
+#ifndef BVH_NO_SIMD
+#if defined(__AVX2__)
+#define BVH_TRIANGLE_BLOCK_SIZE 8
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define BVH_TRIANGLE_BLOCK_SIZE 4
+#include <xmmintrin.h>
+#endif
+#endif // BVH_NO_SIMD
 
 namespace cg
 { // begin namespace cg
 
+#ifdef BVH_TRIANGLE_BLOCK_SIZE
+namespace
+{ // begin namespace
+
+constexpr auto blockSize = BVH_TRIANGLE_BLOCK_SIZE;
+
+#if BVH_TRIANGLE_BLOCK_SIZE == 8
+using vfloat = __m256;
+
+inline auto vset(float x) { return _mm256_set1_ps(x); }
+inline auto vload(const float* p) { return _mm256_load_ps(p); }
+inline auto vstore(float* p, vfloat x) { _mm256_store_ps(p, x); }
+inline auto vadd(vfloat x, vfloat y) { return _mm256_add_ps(x, y); }
+inline auto vsub(vfloat x, vfloat y) { return _mm256_sub_ps(x, y); }
+inline auto vmul(vfloat x, vfloat y) { return _mm256_mul_ps(x, y); }
+inline auto vdiv(vfloat x, vfloat y) { return _mm256_div_ps(x, y); }
+inline auto vand(vfloat x, vfloat y) { return _mm256_and_ps(x, y); }
+inline auto vabs(vfloat x) { return _mm256_andnot_ps(vset(-0.0f), x); }
+inline auto vle(vfloat x, vfloat y) { return _mm256_cmp_ps(x, y, _CMP_LE_OQ); }
+inline auto vgt(vfloat x, vfloat y) { return _mm256_cmp_ps(x, y, _CMP_GT_OQ); }
+inline auto vmask(vfloat x) { return uint32_t(_mm256_movemask_ps(x)); }
+#else
+using vfloat = __m128;
+
+inline auto vset(float x) { return _mm_set1_ps(x); }
+inline auto vload(const float* p) { return _mm_load_ps(p); }
+inline auto vstore(float* p, vfloat x) { _mm_store_ps(p, x); }
+inline auto vadd(vfloat x, vfloat y) { return _mm_add_ps(x, y); }
+inline auto vsub(vfloat x, vfloat y) { return _mm_sub_ps(x, y); }
+inline auto vmul(vfloat x, vfloat y) { return _mm_mul_ps(x, y); }
+inline auto vdiv(vfloat x, vfloat y) { return _mm_div_ps(x, y); }
+inline auto vand(vfloat x, vfloat y) { return _mm_and_ps(x, y); }
+inline auto vabs(vfloat x) { return _mm_andnot_ps(vset(-0.0f), x); }
+inline auto vle(vfloat x, vfloat y) { return _mm_cmple_ps(x, y); }
+inline auto vgt(vfloat x, vfloat y) { return _mm_cmpgt_ps(x, y); }
+inline auto vmask(vfloat x) { return uint32_t(_mm_movemask_ps(x)); }
+#endif // BVH_TRIANGLE_BLOCK_SIZE == 8
+
+inline auto
+vdot(vfloat ax, vfloat ay, vfloat az, vfloat bx, vfloat by, vfloat bz)
+{
+  return vadd(vadd(vmul(ax, bx), vmul(ay, by)), vmul(az, bz));
+}
+
+// Triangles tested at once against a ray, in SoA layout: coordinates
+// of p0, e1, and e2. Unused slots hold degenerate triangles, which
+// are never hit
+struct TriangleBlock
+{
+  alignas(32) float v[9][blockSize];
+
+}; // TriangleBlock
+
+// Distances and barycentric coordinates of the hits of a block
+struct BlockHits
+{
+  alignas(32) float t[blockSize];
+  alignas(32) float b1[blockSize];
+  alignas(32) float b2[blockSize];
+
+  vec3f barycentric(int i) const
+  {
+    return {1 - b1[i] - b2[i], b1[i], b2[i]};
+  }
+
+}; // BlockHits
+
+template <typename F>
+inline void
+loadBlock(TriangleBlock& block, uint32_t n, F triangle)
+{
+  for (uint32_t i = 0; i < blockSize; ++i)
+  {
+    if (i >= n)
+    {
+      for (int k = 0; k < 9; ++k)
+        block.v[k][i] = 0;
+      continue;
+    }
+
+    auto t = triangle(i);
+
+    for (int k = 0; k < 3; ++k)
+    {
+      block.v[k][i] = t.p0[k];
+      block.v[k + 3][i] = t.e1[k];
+      block.v[k + 6][i] = t.e2[k];
+    }
+  }
+}
+
+// Vectorized version of triangle::intersectEdges(). Returns the mask
+// of the triangles hit by the ray
+inline uint32_t
+intersectBlock(const Ray3f& ray,
+  const TriangleBlock& block,
+  BlockHits& hits)
+{
+  const auto& v = block.v;
+  auto dx = vset(ray.direction.x);
+  auto dy = vset(ray.direction.y);
+  auto dz = vset(ray.direction.z);
+  auto e1x = vload(v[3]);
+  auto e1y = vload(v[4]);
+  auto e1z = vload(v[5]);
+  auto e2x = vload(v[6]);
+  auto e2y = vload(v[7]);
+  auto e2z = vload(v[8]);
+  auto s1x = vsub(vmul(dy, e2z), vmul(dz, e2y));
+  auto s1y = vsub(vmul(dz, e2x), vmul(dx, e2z));
+  auto s1z = vsub(vmul(dx, e2y), vmul(dy, e2x));
+  auto det = vdot(s1x, s1y, s1z, e1x, e1y, e1z);
+  auto invDet = vdiv(vset(1), det);
+  auto sx = vsub(vset(ray.origin.x), vload(v[0]));
+  auto sy = vsub(vset(ray.origin.y), vload(v[1]));
+  auto sz = vsub(vset(ray.origin.z), vload(v[2]));
+  auto b1 = vmul(vdot(sx, sy, sz, s1x, s1y, s1z), invDet);
+  auto s2x = vsub(vmul(sy, e1z), vmul(sz, e1y));
+  auto s2y = vsub(vmul(sz, e1x), vmul(sx, e1z));
+  auto s2z = vsub(vmul(sx, e1y), vmul(sy, e1x));
+  auto b2 = vmul(vdot(dx, dy, dz, s2x, s2y, s2z), invDet);
+  auto t = vmul(vdot(e2x, e2y, e2z, s2x, s2y, s2z), invDet);
+  auto zero = vset(0);
+  auto one = vset(1);
+  auto mask = vgt(vabs(det), vset(math::Limits<float>::eps()));
+
+  mask = vand(mask, vand(vle(zero, b1), vle(b1, one)));
+  mask = vand(mask, vand(vle(zero, b2), vle(vadd(b1, b2), one)));
+  mask = vand(mask, vand(vle(vset(ray.tMin), t), vle(t, vset(ray.tMax))));
+  vstore(hits.t, t);
+  vstore(hits.b1, b1);
+  vstore(hits.b2, b2);
+  return vmask(mask);
+}
+
+} // end namespace
+#endif // BVH_TRIANGLE_BLOCK_SIZE
+
 
 /////////////////////////////////////////////////////////////////////
 //
 // TriangleMeshBVH implementation
 // ===============
-TriangleMeshBVH::TriangleMeshBVH(const TriangleMesh& mesh, uint32_t maxt):
-  BVHBase{maxt},
-  _mesh{&mesh}
+TriangleMeshBVH::TriangleMeshBVH(const TriangleMesh& mesh,
+  uint32_t maxt,
+  SplitMethod splitMethod):
+  TriangleMeshBVH{mesh, maxt, splitMethod, true}
 {
-  const auto& m = _mesh->data();
-  auto nt = (uint32_t)m.triangleCount;
+  // do nothing
+}
+
+TriangleMeshBVH::TriangleMeshBVH(const TriangleMesh& mesh,
+  uint32_t maxt,
+  SplitMethod splitMethod,
+  bool buildTree):
+  BVHBase{maxt, splitMethod},
+  _mesh{&mesh},
+  _vertexStamp{mesh.vertexStamp()}
+{
+  auto nt = (uint32_t)_mesh->data().triangleCount;
 
   assert(nt > 0);
+  // A BVH to be loaded from a file is not built
+  if (!buildTree)
+    return;
   _primitiveIds.resize(nt);
 
   PrimitiveInfoArray primitiveInfo(nt);
 
-  for (uint32_t i = 0; i < nt; ++i)
+  parallelFor(nt, [&](uint32_t i)
   {
-    _primitiveIds[i] = i;
-
-    auto t = m.triangles + i;
-    Bounds3f b;
-
-    b.inflate(m.vertices[t->v[0]]);
-    b.inflate(m.vertices[t->v[1]]);
-    b.inflate(m.vertices[t->v[2]]);
-    primitiveInfo[i] = {i, b};
-  }
+    primitiveInfo[i] = {_primitiveIds[i] = i, primitiveBounds(i)};
+  });
   build(primitiveInfo);
 #ifdef _DEBUG
   if (true)
@@ -86,24 +246,201 @@ TriangleMeshBVH::TriangleMeshBVH(const TriangleMesh& mesh, uint32_t maxt):
 #endif // _DEBUG
 }
 
+Bounds3f
+TriangleMeshBVH::primitiveBounds(uint32_t i) const
+{
+  const auto& m = _mesh->data();
+  auto v = m.triangles[i].v;
+  Bounds3f b;
+
+  b.inflate(m.vertices[v[0]]);
+  b.inflate(m.vertices[v[1]]);
+  b.inflate(m.vertices[v[2]]);
+  return b;
+}
+
+void
+TriangleMeshBVH::splitPrimitive(uint32_t i,
+  int dim,
+  float position,
+  Bounds3f& left,
+  Bounds3f& right) const
+{
+  const auto& m = _mesh->data();
+  auto v = m.triangles[i].v;
+
+  // Clip the triangle by the plane: every vertex goes to its side(s),
+  // and the points where edges cross the plane go to both sides
+  left.setEmpty();
+  right.setEmpty();
+  for (int k = 0; k < 3; ++k)
+  {
+    const auto& p = m.vertices[v[k]];
+    const auto& q = m.vertices[v[(k + 1) % 3]];
+    auto pd = p[dim];
+    auto qd = q[dim];
+
+    if (pd <= position)
+      left.inflate(p);
+    if (pd >= position)
+      right.inflate(p);
+    if ((pd < position && qd > position) || (pd > position && qd < position))
+    {
+      auto x = p + (q - p) * ((position - pd) / (qd - pd));
+
+      x[dim] = position;
+      left.inflate(x);
+      right.inflate(x);
+    }
+  }
+}
+
+bool
+TriangleMeshBVH::refit(float maxCostRatio)
+{
+  auto stamp = _mesh->vertexStamp();
+  auto rebuilt = BVHBase::refit(maxCostRatio);
+
+  if (!_leafTriangles.empty())
+    makeLeafTriangles();
+  // The stamp is released last, thus a thread which finds the BVH
+  // not stale sees it refitted
+  _vertexStamp.store(stamp, std::memory_order_release);
+  return rebuilt;
+}
+
+bool
+TriangleMeshBVH::refitIfStale(float maxCostRatio)
+{
+  std::lock_guard lock{_refitLock};
+
+  if (!isStale())
+    return false;
+  refit(maxCostRatio);
+  return true;
+}
+
+inline TriangleMeshBVH::LeafTriangle
+TriangleMeshBVH::meshTriangle(uint32_t i) const
+{
+  const auto& m = _mesh->data();
+  auto v = m.triangles[i].v;
+  const auto& p0 = m.vertices[v[0]];
+
+  return {p0, m.vertices[v[1]] - p0, m.vertices[v[2]] - p0};
+}
+
+void
+TriangleMeshBVH::makeLeafTriangles()
+{
+  auto n = uint32_t(_primitiveIds.size());
+
+  _leafTriangles.resize(n);
+  parallelFor(n, [this](uint32_t i)
+  {
+    _leafTriangles[i] = meshTriangle(_primitiveIds[i]);
+  });
+}
+
+uint32_t
+TriangleMeshBVH::triangleBlockSize()
+{
+#ifdef BVH_TRIANGLE_BLOCK_SIZE
+  return BVH_TRIANGLE_BLOCK_SIZE;
+#else
+  return 1;
+#endif // BVH_TRIANGLE_BLOCK_SIZE
+}
+
+void
+TriangleMeshBVH::setLeafTriangles(bool enabled)
+{
+  if (enabled)
+    makeLeafTriangles();
+  else
+    std::vector<LeafTriangle>{}.swap(_leafTriangles);
+}
+
+uint64_t
+TriangleMeshBVH::fileKey(const TriangleMesh& mesh,
+  uint32_t maxt,
+  SplitMethod splitMethod)
+{
+  const auto& m = mesh.data();
+  uint32_t params[]{maxt, uint32_t(splitMethod)};
+  auto key = hash(m.vertices, m.vertexCount * sizeof(vec3f));
+
+  key = hash(m.triangles, m.triangleCount * sizeof(m.triangles[0]), key);
+  return hash(params, sizeof params, key);
+}
+
+TriangleMeshBVH*
+TriangleMeshBVH::load(const char* filename,
+  const TriangleMesh& mesh,
+  uint32_t maxt,
+  SplitMethod splitMethod)
+{
+  FILE* file = fopen(filename, "rb");
+
+  if (file == nullptr)
+    return nullptr;
+
+  auto bvh = new TriangleMeshBVH{mesh, maxt, splitMethod, false};
+  auto key = fileKey(mesh, maxt, splitMethod);
+
+  if (!bvh->read(file, key, (uint32_t)mesh.data().triangleCount))
+  {
+    delete bvh;
+    bvh = nullptr;
+  }
+  fclose(file);
+  return bvh;
+}
+
+bool
+TriangleMeshBVH::save(const char* filename) const
+{
+  FILE* file = fopen(filename, "wb");
+
+  if (file == nullptr)
+    return false;
+
+  auto key = fileKey(*_mesh, maxPrimitivesPerNode(), splitMethod());
+  auto ok = write(file, key);
+
+  return fclose(file) == 0 && ok;
+}
+
+// Leaf tests take blocks of triangles while at least two of them
+// remain, and a last single triangle alone. Hits within a block are
+// processed in the order of the triangles, as in the scalar tests
 bool
 TriangleMeshBVH::intersectLeaf(uint32_t first,
   uint32_t count,
   const Ray3f& ray) const
 {
-  const auto& m = _mesh->data();
+  auto i = first;
+  auto e = i + count;
 
-  for (auto i = first, e = i + count; i < e; ++i)
+#ifdef BVH_TRIANGLE_BLOCK_SIZE
+  for (uint32_t n; _triangleBlocks && e - i >= 2; i += n)
   {
-    auto tid = _primitiveIds[i];
-    auto v = m.triangles[tid].v;
-    const auto& p0 = m.vertices[v[0]];
-    const auto& p1 = m.vertices[v[1]];
-    const auto& p2 = m.vertices[v[2]];
+    TriangleBlock block;
+    BlockHits bh;
+
+    n = std::min<uint32_t>(blockSize, e - i);
+    loadBlock(block, n, [&](uint32_t j) { return leafTriangle(i + j); });
+    if (intersectBlock(ray, block, bh) != 0)
+      return true;
+  }
+#endif // BVH_TRIANGLE_BLOCK_SIZE
+  for (; i < e; ++i)
+  {
+    auto tri = leafTriangle(i);
     vec3f b;
     float t;
 
-    if (triangle::intersect(ray, p0, p1, p2, b, t))
+    if (triangle::intersectEdges(ray, tri.p0, tri.e1, tri.e2, b, t))
       return true;
   }
   return false;
@@ -115,22 +452,45 @@ TriangleMeshBVH::intersectLeaf(uint32_t first,
   const Ray3f& ray,
   Intersection& hit) const
 {
-  const auto& m = _mesh->data();
   auto hitCount = 0;
+  auto i = first;
+  auto e = i + count;
 
-  for (auto i = first, e = i + count; i < e; ++i)
+  // A triangle referenced by several leaves (SBVH) can be hit again,
+  // but not closer than before. The mesh triangle index is read only
+  // for hits
+#ifdef BVH_TRIANGLE_BLOCK_SIZE
+  for (uint32_t n; _triangleBlocks && e - i >= 2; i += n)
+  {
+    TriangleBlock block;
+    BlockHits bh;
+
+    n = std::min<uint32_t>(blockSize, e - i);
+    loadBlock(block, n, [&](uint32_t j) { return leafTriangle(i + j); });
+    for (auto m = intersectBlock(ray, block, bh); m != 0; m &= m - 1)
+    {
+      auto j = std::countr_zero(m);
+
+      if (bh.t[j] < hit.distance)
+      {
+        hit.triangleIndex = _primitiveIds[i + j];
+        hit.distance = bh.t[j];
+        hit.p = bh.barycentric(j);
+        hitCount++;
+      }
+    }
+  }
+#endif // BVH_TRIANGLE_BLOCK_SIZE
+  for (; i < e; ++i)
   {
-    auto tid = _primitiveIds[i];
-    auto v = m.triangles[tid].v;
-    const auto& p0 = m.vertices[v[0]];
-    const auto& p1 = m.vertices[v[1]];
-    const auto& p2 = m.vertices[v[2]];
+    auto tri = leafTriangle(i);
     vec3f b;
     float t;
 
-    if (triangle::intersect(ray, p0, p1, p2, b, t) && t < hit.distance)
+    if (triangle::intersectEdges(ray, tri.p0, tri.e1, tri.e2, b, t) &&
+      t < hit.distance)
     {
-      hit.triangleIndex = tid;
+      hit.triangleIndex = _primitiveIds[i];
       hit.distance = t;
       hit.p = b;
       hitCount++;
@@ -140,4 +500,270 @@ TriangleMeshBVH::intersectLeaf(uint32_t first,
     hit.object = _mesh;
 }
 
+BVHBase::RayMask
+TriangleMeshBVH::intersectLeaf(uint32_t first,
+  uint32_t count,
+  const Ray3f* rays,
+  RayMask mask) const
+{
+  RayMask hitMask{};
+  auto i = first;
+  auto e = i + count;
+
+  // Every triangle (or block of triangles) is fetched once and tested
+  // against the rays of the packet not yet known to be occluded
+#ifdef BVH_TRIANGLE_BLOCK_SIZE
+  for (uint32_t n; _triangleBlocks && e - i >= 2 && mask != 0; i += n)
+  {
+    TriangleBlock block;
+    BlockHits bh;
+
+    n = std::min<uint32_t>(blockSize, e - i);
+    loadBlock(block, n, [&](uint32_t j) { return leafTriangle(i + j); });
+    for (auto active = mask; active != 0; active &= active - 1)
+    {
+      auto r = std::countr_zero(active);
+
+      if (intersectBlock(rays[r], block, bh) != 0)
+        hitMask |= RayMask{1} << r;
+    }
+    mask &= ~hitMask;
+  }
+#endif // BVH_TRIANGLE_BLOCK_SIZE
+  for (; i < e && mask != 0; ++i)
+  {
+    auto tri = leafTriangle(i);
+
+    for (auto active = mask; active != 0; active &= active - 1)
+    {
+      auto r = std::countr_zero(active);
+      vec3f b;
+      float t;
+
+      if (triangle::intersectEdges(rays[r], tri.p0, tri.e1, tri.e2, b, t))
+        hitMask |= RayMask{1} << r;
+    }
+    mask &= ~hitMask;
+  }
+  return hitMask;
+}
+
+void
+TriangleMeshBVH::intersectLeaf(uint32_t first,
+  uint32_t count,
+  const Ray3f* rays,
+  RayMask mask,
+  Intersection* hits) const
+{
+  auto i = first;
+  auto e = i + count;
+
+#ifdef BVH_TRIANGLE_BLOCK_SIZE
+  for (uint32_t n; _triangleBlocks && e - i >= 2; i += n)
+  {
+    TriangleBlock block;
+    BlockHits bh;
+
+    n = std::min<uint32_t>(blockSize, e - i);
+    loadBlock(block, n, [&](uint32_t j) { return leafTriangle(i + j); });
+    for (auto active = mask; active != 0; active &= active - 1)
+    {
+      auto r = std::countr_zero(active);
+      auto& hit = hits[r];
+
+      for (auto m = intersectBlock(rays[r], block, bh); m != 0; m &= m - 1)
+      {
+        auto j = std::countr_zero(m);
+
+        if (bh.t[j] < hit.distance)
+        {
+          hit.object = _mesh;
+          hit.triangleIndex = _primitiveIds[i + j];
+          hit.distance = bh.t[j];
+          hit.p = bh.barycentric(j);
+        }
+      }
+    }
+  }
+#endif // BVH_TRIANGLE_BLOCK_SIZE
+  for (; i < e; ++i)
+  {
+    auto tri = leafTriangle(i);
+
+    for (auto active = mask; active != 0; active &= active - 1)
+    {
+      auto r = std::countr_zero(active);
+      auto& hit = hits[r];
+      vec3f b;
+      float t;
+
+      if (triangle::intersectEdges(rays[r], tri.p0, tri.e1, tri.e2, b, t) &&
+        t < hit.distance)
+      {
+        hit.object = _mesh;
+        hit.triangleIndex = _primitiveIds[i];
+        hit.distance = t;
+        hit.p = b;
+      }
+    }
+  }
+}
+
+bool
+TriangleMeshBVH::canFindClosestPoints() const
+{
+  return true;
+}
+
+void
+TriangleMeshBVH::closestPointLeaf(uint32_t first,
+  uint32_t count,
+  const vec3f& p,
+  ClosestPoint& c) const
+{
+  for (auto i = first, e = i + count; i < e; ++i)
+  {
+    auto tri = leafTriangle(i);
+    vec3f b;
+    auto q = triangle::closestPoint(p,
+      tri.p0,
+      tri.p0 + tri.e1,
+      tri.p0 + tri.e2,
+      b);
+    auto d = (q - p).length();
+
+    if (d < c.distance)
+    {
+      c.primitiveId = _primitiveIds[i];
+      c.point = q;
+      c.coordinates = b;
+      c.distance = d;
+    }
+  }
+}
+
+void
+TriangleMeshBVH::overlap(const TriangleMeshBVH& other,
+  const mat4f& m,
+  std::vector<TrianglePair>& pairs,
+  bool exact) const
+{
+  findTrianglePairs(other, m, false, exact, pairs);
+}
+
+void
+TriangleMeshBVH::selfOverlap(std::vector<TrianglePair>& pairs,
+  bool exact) const
+{
+  findTrianglePairs(*this, mat4f::identity(), true, exact, pairs);
+}
+
+namespace
+{ // begin namespace
+
+// Returns true if two triangles, given by their vertex indices, share
+// a vertex. Coincident vertices with distinct indices are not shared
+inline bool
+shareVertex(const int* v1, const int* v2)
+{
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      if (v1[i] == v2[j])
+        return true;
+  return false;
+}
+
+} // end namespace
+
+void
+TriangleMeshBVH::findTrianglePairs(const TriangleMeshBVH& other,
+  const mat4f& m,
+  bool self,
+  bool exact,
+  std::vector<TrianglePair>& pairs) const
+{
+  std::vector<LeafPair> leafPairs;
+
+  if (self)
+    BVHBase::selfOverlap(leafPairs);
+  else
+    BVHBase::overlap(other, m, leafPairs);
+  pairs.clear();
+
+  const auto& d1 = _mesh->data();
+  const auto& d2 = other._mesh->data();
+  // Leaf pairs are processed in parallel in chunks, each of which has
+  // its own output
+  constexpr uint32_t chunkSize = 256;
+  auto n = uint32_t(leafPairs.size());
+  auto chunkCount = (n + chunkSize - 1) / chunkSize;
+  std::vector<std::vector<TrianglePair>> chunkPairs(chunkCount);
+
+  parallelFor(chunkCount, [&](uint32_t c)
+  {
+    auto& out = chunkPairs[c];
+
+    auto e = std::min((c + 1) * chunkSize, n);
+
+    for (auto k = c * chunkSize; k < e; ++k)
+    {
+      const auto& leafPair = leafPairs[k];
+      // The pairs of triangles of a leaf and itself are visited once
+      auto sameLeaf = self && leafPair.first1 == leafPair.first2;
+
+      for (uint32_t i = 0; i < leafPair.count1; ++i)
+      {
+        auto t1 = _primitiveIds[leafPair.first1 + i];
+        const auto v1 = d1.triangles[t1].v;
+        const vec3f p[]
+        {
+          d1.vertices[v1[0]],
+          d1.vertices[v1[1]],
+          d1.vertices[v1[2]]
+        };
+
+        for (auto j = sameLeaf ? i + 1 : 0; j < leafPair.count2; ++j)
+        {
+          auto t2 = other._primitiveIds[leafPair.first2 + j];
+          const auto v2 = d2.triangles[t2].v;
+          vec3f q[]
+          {
+            d2.vertices[v2[0]],
+            d2.vertices[v2[1]],
+            d2.vertices[v2[2]]
+          };
+
+          if (self)
+          {
+            if (t1 == t2 || shareVertex(v1, v2))
+              continue;
+          }
+          else
+            for (auto& v : q)
+              v = m.transform3x4(v);
+          if (exact && !triangle::overlap(p[0], p[1], p[2], q[0], q[1], q[2]))
+            continue;
+          if (self && t2 < t1)
+            out.push_back({t2, t1});
+          else
+            out.push_back({t1, t2});
+        }
+      }
+    }
+  }, 1);
+  for (const auto& p : chunkPairs)
+    pairs.insert(pairs.end(), p.begin(), p.end());
+  // With spatial splits, the same pair of triangles can be found in
+  // several pairs of leaves
+  std::sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b)
+  {
+    return a.first < b.first || (a.first == b.first && a.second < b.second);
+  });
+  pairs.erase(std::unique(pairs.begin(), pairs.end(), [](const auto& a,
+    const auto& b)
+  {
+    return a.first == b.first && a.second == b.second;
+  }), pairs.end());
+}
+
 } // end namespace cg
@@ -28,7 +28,7 @@
 // Source file for generic image.
 //
 // Author: Paulo Pagliosa
-// Last revision: 10/02/2022
+// Last revision: 17/10/2026
 
 #include "graphics/Image.h"
 #include <algorithm>
@@ -110,7 +110,7 @@ Image::setData(int x, int y, const ImageBuffer& buffer)
   if (x + w > _W)
     w = _W - x;
   if (y + h > _H)
-    h = _W - y;
+    h = _H - y;
   setSubImage(x, y, w, h, buffer._data);
 }
 
@@ -126,7 +126,7 @@ Image::data(int x, int y, int w, int h) const
   if (x + w > _W)
     w = _W - x;
   if (y + h > _H)
-    h = _W - y;
+    h = _H - y;
 
   ImageBuffer buffer{w, h};
 
@@ -0,0 +1,324 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2026 Paulo Pagliosa.                              |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: ImageWriter.cpp
+// ========
+// Source file for image file writers.
+//
+// Author: Paulo Pagliosa
+// Last revision: 17/10/2026
+
+#include "graphics/ImageWriter.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+
+namespace cg
+{ // begin namespace cg
+
+static_assert(sizeof(Pixel) == 3, "Pixel must be packed RGB");
+
+namespace
+{ // begin namespace
+
+inline uint8_t
+toByte(float c)
+{
+  return uint8_t(255 * math::clamp(c, 0.0f, 1.0f));
+}
+
+inline void
+putBigEndian(uint8_t* p, uint32_t x)
+{
+  p[0] = uint8_t(x >> 24);
+  p[1] = uint8_t(x >> 16);
+  p[2] = uint8_t(x >> 8);
+  p[3] = uint8_t(x);
+}
+
+uint32_t
+crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+  static const auto table = []()
+  {
+    std::vector<uint32_t> t(256);
+
+    for (uint32_t n = 0; n < 256; ++n)
+    {
+      auto c = n;
+
+      for (auto k = 0; k < 8; ++k)
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      t[n] = c;
+    }
+    return t;
+  }();
+
+  crc = ~crc;
+  while (size--)
+    crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+uint32_t
+adler32(uint32_t adler, const uint8_t* data, size_t size)
+{
+  constexpr uint32_t base = 65521;
+  // Greatest number of bytes whose sums do not overflow 32 bits
+  constexpr size_t maxRun = 5552;
+  uint32_t a = adler & 0xffff;
+  uint32_t b = adler >> 16;
+
+  while (size > 0)
+  {
+    auto n = std::min(size, maxRun);
+
+    size -= n;
+    while (n--)
+      b += a += *data++;
+    a %= base;
+    b %= base;
+  }
+  return b << 16 | a;
+}
+
+} // end namespace
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// ImageWriter implementation
+// ===========
+ImageWriter*
+ImageWriter::New(const char* filename)
+{
+  auto ext = std::filesystem::path{filename}.extension().string();
+
+  for (auto& c : ext)
+    c = (char)tolower(c);
+  if (ext == ".ppm")
+    return new PPMWriter;
+  if (ext == ".pfm")
+    return new PFMWriter;
+  if (ext == ".png")
+    return new PNGWriter;
+  return nullptr;
+}
+
+ImageWriter::~ImageWriter()
+{
+  // The trailer of a file not closed by close() is not written
+  if (_file != nullptr)
+    fclose(_file);
+}
+
+bool
+ImageWriter::open(const char* filename, int width, int height)
+{
+  if (_file != nullptr)
+    close();
+  if ((_file = fopen(filename, "wb")) == nullptr)
+    return false;
+  _W = width;
+  _H = height;
+  _failed = false;
+  writeHeader();
+  return !_failed;
+}
+
+bool
+ImageWriter::close()
+{
+  if (_file == nullptr)
+    return false;
+  writeTrailer();
+  if (fclose(_file) != 0)
+    _failed = true;
+  _file = nullptr;
+  return !_failed;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// PPMWriter implementation
+// =========
+void
+PPMWriter::writeHeader()
+{
+  fprintf(_file, "P6\n%d %d\n255\n", _W, _H);
+}
+
+void
+PPMWriter::writeRow(const Pixel* pixels)
+{
+  write(pixels, size_t(_W) * 3);
+}
+
+void
+PPMWriter::writeRow(const float* rgb)
+{
+  _row.resize(size_t(_W) * 3);
+  std::transform(rgb, rgb + _row.size(), _row.begin(), toByte);
+  write(_row.data(), _row.size());
+}
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// PFMWriter implementation
+// =========
+void
+PFMWriter::writeHeader()
+{
+  // A negative scale means little-endian floats
+  fprintf(_file, "PF\n%d %d\n-1.0\n", _W, _H);
+}
+
+void
+PFMWriter::writeRow(const Pixel* pixels)
+{
+  constexpr auto s = 1.0f / 255;
+
+  _row.resize(size_t(_W) * 3);
+  for (size_t i = 0; i < _row.size(); i += 3, ++pixels)
+  {
+    _row[i] = pixels->r * s;
+    _row[i + 1] = pixels->g * s;
+    _row[i + 2] = pixels->b * s;
+  }
+  writeRow(_row.data());
+}
+
+void
+PFMWriter::writeRow(const float* rgb)
+{
+  write(rgb, size_t(_W) * 3 * sizeof(float));
+}
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// PNGWriter implementation
+// =========
+// The image data are written as a zlib stream of uncompressed
+// (stored) deflate blocks, one IDAT chunk per row, thus no row but
+// the current one is kept in memory
+void
+PNGWriter::writeChunk(const char* type, const uint8_t* data, size_t size)
+{
+  uint8_t buffer[4];
+  auto t = (const uint8_t*)type;
+
+  putBigEndian(buffer, uint32_t(size));
+  write(buffer, 4);
+  write(t, 4);
+  write(data, size);
+  putBigEndian(buffer, crc32(crc32(0, t, 4), data, size));
+  write(buffer, 4);
+}
+
+void
+PNGWriter::writeHeader()
+{
+  const uint8_t signature[]{0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  uint8_t ihdr[13];
+  // zlib header: deflate with 32K window, no preset dictionary
+  const uint8_t zlib[]{0x78, 0x01};
+
+  write(signature, sizeof signature);
+  putBigEndian(ihdr, _W);
+  putBigEndian(ihdr + 4, _H);
+  ihdr[8] = 8; // bit depth
+  ihdr[9] = 2; // color type: RGB
+  ihdr[10] = 0; // compression method
+  ihdr[11] = 0; // filter method
+  ihdr[12] = 0; // no interlace
+  writeChunk("IHDR", ihdr, sizeof ihdr);
+  writeChunk("IDAT", zlib, sizeof zlib);
+  _adler = 1;
+}
+
+void
+PNGWriter::writeImageData(const uint8_t* data, size_t size, bool last)
+{
+  // Stored deflate blocks have at most 65535 bytes
+  constexpr size_t maxBlockSize = 65535;
+  std::vector<uint8_t> chunk;
+
+  chunk.reserve(size + (size / maxBlockSize + 1) * 5);
+  do
+  {
+    auto n = std::min(size, maxBlockSize);
+
+    chunk.push_back(last && n == size);
+    chunk.push_back(uint8_t(n));
+    chunk.push_back(uint8_t(n >> 8));
+    chunk.push_back(uint8_t(~n));
+    chunk.push_back(uint8_t(~n >> 8));
+    chunk.insert(chunk.end(), data, data + n);
+    data += n;
+    size -= n;
+  } while (size > 0);
+  writeChunk("IDAT", chunk.data(), chunk.size());
+}
+
+void
+PNGWriter::writeRow(const Pixel* pixels)
+{
+  auto n = size_t(_W) * 3;
+
+  _row.resize(n + 1);
+  _row[0] = 0; // filter type: none
+  memcpy(_row.data() + 1, pixels, n);
+  _adler = adler32(_adler, _row.data(), _row.size());
+  writeImageData(_row.data(), _row.size(), false);
+}
+
+void
+PNGWriter::writeRow(const float* rgb)
+{
+  auto n = size_t(_W) * 3;
+
+  _row.resize(n + 1);
+  _row[0] = 0; // filter type: none
+  std::transform(rgb, rgb + n, _row.begin() + 1, toByte);
+  _adler = adler32(_adler, _row.data(), _row.size());
+  writeImageData(_row.data(), _row.size(), false);
+}
+
+void
+PNGWriter::writeTrailer()
+{
+  // Empty final block followed by the Adler-32 of the image data
+  uint8_t trailer[9]{1, 0, 0, 0xff, 0xff};
+
+  putBigEndian(trailer + 5, _adler);
+  writeChunk("IDAT", trailer, sizeof trailer);
+  writeChunk("IEND", nullptr, 0);
+}
+
+} // end namespace cg
@@ -0,0 +1,81 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2026 Paulo Pagliosa.                              |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: LightBVH.cpp
+// ========
+// Source file for light BVH.
+//
+// Author: Paulo Pagliosa
+// Last revision: 17/10/2026
+
+#include "graphics/LightBVH.h"
+
+namespace cg
+{ // begin namespace cg
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// LightBVH implementation
+// ========
+LightBVH::LightBVH(LightArray&& lights, uint32_t maxLightsPerNode):
+  BVHBase{maxLightsPerNode, SplitMethod::SAH},
+  _lights{std::move(lights)}
+{
+  auto nl = (uint32_t)_lights.size();
+
+  assert(nl > 0);
+  _primitiveIds.resize(nl);
+
+  PrimitiveInfoArray primitiveInfo(nl);
+
+  for (uint32_t i = 0; i < nl; ++i)
+    primitiveInfo[i] = {_primitiveIds[i] = i, primitiveBounds(i)};
+  build(primitiveInfo);
+}
+
+Bounds3f
+LightBVH::primitiveBounds(uint32_t i) const
+{
+  return lightBounds(*_lights[i]);
+}
+
+bool
+LightBVH::intersectLeaf(uint32_t, uint32_t, const Ray3f&) const
+{
+  // Lights are not hit by rays
+  return false;
+}
+
+void
+LightBVH::intersectLeaf(uint32_t,
+  uint32_t,
+  const Ray3f&,
+  Intersection&) const
+{
+  // do nothing
+}
+
+} // end namespace cg
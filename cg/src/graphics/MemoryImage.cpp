@@ -0,0 +1,212 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2026 Paulo Pagliosa.                              |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: MemoryImage.cpp
+// ========
+// Source file for image kept in main memory.
+//
+// Author: Paulo Pagliosa
+// Last revision: 17/10/2026
+
+#include "graphics/MemoryImage.h"
+#include <algorithm>
+
+namespace cg
+{ // begin namespace cg
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// MemoryImage implementation
+// ===========
+MemoryImage::MemoryImage(int width, int height, bool hdr):
+  Image{width, height}
+{
+  if (hdr)
+    _rgb.resize(size_t(width) * height * 3);
+  else
+    _pixels = ImageBuffer{width, height};
+}
+
+void
+MemoryImage::draw(int, int) const
+{
+  // do nothing
+}
+
+void
+MemoryImage::setTile(int x,
+  int y,
+  int w,
+  int h,
+  const Color* colors,
+  int stride)
+{
+  for (auto j = 0; j < h; ++j, colors += stride)
+    if (isHDR())
+    {
+      auto rgb = _rgb.data() + (size_t(y + j) * _W + x) * 3;
+
+      for (auto i = 0; i < w; ++i, rgb += 3)
+      {
+        rgb[0] = colors[i].r;
+        rgb[1] = colors[i].g;
+        rgb[2] = colors[i].b;
+      }
+    }
+    else
+    {
+      auto pixel = &_pixels(x, y + j);
+
+      for (auto i = 0; i < w; ++i)
+        pixel[i].set(Color{math::clamp(colors[i].r, 0.0f, 1.0f),
+          math::clamp(colors[i].g, 0.0f, 1.0f),
+          math::clamp(colors[i].b, 0.0f, 1.0f)});
+    }
+  rowsChanged(y, h, w);
+}
+
+void
+MemoryImage::setSubImage(int x, int y, int w, int h, const Pixel* data)
+{
+  constexpr auto s = 1.0f / 255;
+
+  for (auto j = 0; j < h; ++j, data += w)
+    if (isHDR())
+    {
+      auto rgb = _rgb.data() + (size_t(y + j) * _W + x) * 3;
+
+      for (auto i = 0; i < w; ++i, rgb += 3)
+      {
+        rgb[0] = data[i].r * s;
+        rgb[1] = data[i].g * s;
+        rgb[2] = data[i].b * s;
+      }
+    }
+    else
+      std::copy_n(data, w, &_pixels(x, y + j));
+  rowsChanged(y, h, w);
+}
+
+void
+MemoryImage::getSubImage(int x, int y, int w, int h, Pixel* data) const
+{
+  for (auto j = 0; j < h; ++j, data += w)
+    if (isHDR())
+    {
+      auto rgb = hdrRow(y + j) + size_t(x) * 3;
+
+      for (auto i = 0; i < w; ++i, rgb += 3)
+        data[i].set(Color{math::clamp(rgb[0], 0.0f, 1.0f),
+          math::clamp(rgb[1], 0.0f, 1.0f),
+          math::clamp(rgb[2], 0.0f, 1.0f)});
+    }
+    else
+      std::copy_n(&_pixels(x, y + j), w, data);
+}
+
+inline void
+MemoryImage::writeRow(ImageWriter& writer, int y) const
+{
+  if (isHDR())
+    writer.writeRow(hdrRow(y));
+  else
+    writer.writeRow(pixelRow(y));
+}
+
+void
+MemoryImage::rowsChanged(int y, int h, int w)
+{
+  if (_rowCounts == nullptr)
+    return;
+
+  // The counts are released by the threads which set the rows and
+  // acquired by the one which writes them
+  auto completed = false;
+
+  for (auto j = y; j < y + h; ++j)
+    if (_rowCounts[j].fetch_add(w, std::memory_order_acq_rel) + w >= _W)
+      completed = true;
+  if (!completed)
+    return;
+
+  std::lock_guard lock{_writerLock};
+  auto bottomUp = _writer->bottomUp();
+
+  for (; _writtenRows < _H; ++_writtenRows)
+  {
+    auto row = bottomUp ? _writtenRows : _H - 1 - _writtenRows;
+
+    if (_rowCounts[row].load(std::memory_order_acquire) < _W)
+      break;
+    writeRow(*_writer, row);
+  }
+}
+
+void
+MemoryImage::setWriter(ImageWriter& writer)
+{
+  if (writer.width() != _W || writer.height() != _H || !writer.isOpen())
+    throw std::logic_error("MemoryImage: bad writer");
+  _writer = &writer;
+  _rowCounts = std::make_unique<std::atomic<int>[]>(_H);
+  _writtenRows = 0;
+}
+
+bool
+MemoryImage::closeWriter()
+{
+  if (_writer == nullptr)
+    return false;
+
+  std::lock_guard lock{_writerLock};
+  auto bottomUp = _writer->bottomUp();
+
+  for (; _writtenRows < _H; ++_writtenRows)
+    writeRow(*_writer, bottomUp ? _writtenRows : _H - 1 - _writtenRows);
+
+  auto ok = _writer->close();
+
+  _writer = nullptr;
+  _rowCounts.reset();
+  return ok;
+}
+
+bool
+MemoryImage::write(const char* filename) const
+{
+  Reference<ImageWriter> writer = ImageWriter::New(filename);
+
+  if (writer == nullptr || !writer->open(filename, _W, _H))
+    return false;
+
+  auto bottomUp = writer->bottomUp();
+
+  for (auto k = 0; k < _H; ++k)
+    writeRow(*writer, bottomUp ? k : _H - 1 - k);
+  return writer->close();
+}
+
+} // end namespace cg
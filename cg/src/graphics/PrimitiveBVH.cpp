@@ -28,7 +28,7 @@
 // Souce file for primitive BVH.
 //
 // Author: Paulo Pagliosa
-// Last revision: 24/01/2022
+// Last revision: 17/10/2026
 
 #include "graphics/PrimitiveBVH.h"
 
@@ -58,4 +58,63 @@ PrimitiveBVH::bounds() const
   return _bvh->bounds();
 }
 
+namespace
+{ // begin namespace
+
+// Transforms a packet of world rays into local space, as done by
+// Primitive::intersect() for a single ray. The scales of the hit
+// distances are stored into s
+inline void
+transform(std::span<const Ray3f> rays,
+  const mat4f& m,
+  Ray3f* localRays,
+  float* s)
+{
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    auto& r = localRays[i];
+
+    r.origin = m.transform3x4(rays[i].origin);
+    r.direction = m.transformVector(rays[i].direction);
+
+    auto d = r.direction.length();
+
+    r.tMin = rays[i].tMin * d;
+    r.tMax = rays[i].tMax * d;
+    r.direction *= (s[i] = 1 / d);
+  }
+}
+
+} // end namespace
+
+PrimitiveBVH::RayMask
+PrimitiveBVH::intersect(std::span<const Ray3f> rays) const
+{
+  assert(rays.size() <= maxPacketSize);
+
+  Ray3f localRays[maxPacketSize];
+  float s[maxPacketSize];
+
+  transform(rays, _worldToLocal, localRays, s);
+  return _bvh->intersect({localRays, rays.size()});
+}
+
+PrimitiveBVH::RayMask
+PrimitiveBVH::intersect(std::span<const Ray3f> rays,
+  std::span<Intersection> hits) const
+{
+  assert(rays.size() <= maxPacketSize);
+
+  Ray3f localRays[maxPacketSize];
+  float s[maxPacketSize];
+
+  transform(rays, _worldToLocal, localRays, s);
+
+  auto hitMask = _bvh->intersect({localRays, rays.size()}, hits);
+
+  for (size_t i = 0; i < rays.size(); ++i)
+    hits[i].distance *= s[i];
+  return hitMask;
+}
+
 } // end namespace cg
@@ -28,7 +28,7 @@
 // Source file for generic transformable object.
 //
 // Author: Paulo Pagliosa
-// Last revision: 01/08/2023
+// Last revision: 17/10/2026
 
 #include "graphics/TransformableObject.h"
 
@@ -45,6 +45,7 @@ TransformableObject::setTransform(const mat4f& l2w, const mat4f& w2l)
 {
   _localToWorld = l2w;
   _worldToLocal = w2l;
+  ++_transformStamp;
 }
 
 void
@@ -68,6 +69,7 @@ TransformableObject::setTransform(const vec3f& p,
   _worldToLocal[3][1] = -(r[1].dot(p));
   _worldToLocal[3][2] = -(r[2].dot(p));
   _worldToLocal[3][3] = 1;
+  ++_transformStamp;
 }
 
 } // end namespace cg
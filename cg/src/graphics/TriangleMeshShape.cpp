@@ -28,11 +28,15 @@
 // Class definition for triangle mesh shape.
 //
 // Author: Paulo Pagliosa
-// Last revision: 01/08/2023
+// Last revision: 17/10/2026
 
 #include "graphics/TriangleMeshShape.h"
 #include <cassert>
+#include <condition_variable>
+#include <filesystem>
+#include <list>
 #include <map>
+#include <mutex>
 
 namespace cg
 { // begin namespace cg
@@ -42,35 +46,211 @@ namespace cg
 //
 // TriangleMeshShape implementation
 // =================
-class BVHBuilder
+// Cache of the BVHs of meshes, shared by all shapes of a mesh with
+// the same BVH width. The cache is thread-safe: concurrent requests
+// for the BVH of the same mesh and width build (or load) it once.
+// When the memory of the cached BVHs exceeds a budget, the least
+// recently used BVHs that are not used by any shape are evicted.
+// BVHs of meshes referenced only by their BVHs are evicted regardless
+// of the budget
+class BVHCache
 {
 public:
-  using BVHMap = std::map<uint32_t, Reference<TriangleMeshBVH>>;
+  using Statistics = TriangleMeshShape::BVHCacheStatistics;
 
-  TriangleMeshBVH* bvh(const TriangleMesh& mesh)
+  // References to cached BVHs are taken while the cache is locked.
+  // The width of a BVH is set before it is cached, and never changed
+  // afterwards
+  void getBVH(const TriangleMesh& mesh,
+    uint32_t width,
+    Reference<TriangleMeshBVH>& bvh)
   {
+    const Key key{mesh.id, width};
+    std::unique_lock lock{_mutex};
+
+    for (;;)
     {
-      auto mit = _map.find(mesh.id);
+      auto eit = _entries.find(key);
+
+      if (eit == _entries.end())
+        break;
+
+      auto& e = eit->second;
+
+      // An entry without a BVH is being built by another thread, which
+      // removes the entry if the build fails
+      if (e.bvh != nullptr)
+      {
+        ++_hits;
+        _lru.splice(_lru.begin(), _lru, e.lru);
+        bvh = e.bvh;
+        return;
+      }
+      _built.wait(lock);
+    }
+    ++_misses;
 
-      if (_map.end() != mit)
-        return mit->second;
+    auto& e = _entries[key];
+    auto cacheDirectory = _cacheDirectory;
+
+    lock.unlock();
+
+    Reference<TriangleMeshBVH> newBVH;
+
+    try
+    {
+      newBVH = makeBVH(mesh, cacheDirectory);
+      newBVH->setWidth(width);
+    }
+    catch (...)
+    {
+      lock.lock();
+      _entries.erase(key);
+      _built.notify_all();
+      throw;
+    }
+    lock.lock();
+    e.bvh = bvh = newBVH;
+    e.lru = _lru.insert(_lru.begin(), key);
+    evict();
+    _built.notify_all();
+  }
+
+  void setBudget(size_t budget)
+  {
+    std::lock_guard lock{_mutex};
+
+    _budget = budget;
+    evict();
+  }
+
+  void setCacheDirectory(const char* path)
+  {
+    std::lock_guard lock{_mutex};
+
+    _cacheDirectory = path == nullptr ? "" : path;
+    if (!_cacheDirectory.empty())
+    {
+      std::error_code ec;
+      std::filesystem::create_directories(_cacheDirectory, ec);
+    }
+  }
+
+  Statistics statistics()
+  {
+    std::lock_guard lock{_mutex};
+    Statistics s{_hits, _misses, _evictions, 0, 0, _budget};
+
+    for (const auto& [key, e] : _entries)
+      if (e.bvh != nullptr)
+      {
+        ++s.bvhCount;
+        s.memory += e.bvh->memorySize();
+      }
+    return s;
+  }
+
+private:
+  // Mesh id and BVH width
+  using Key = std::pair<uint32_t, uint32_t>;
+
+  struct Entry
+  {
+    Reference<TriangleMeshBVH> bvh; // null while being built
+    std::list<Key>::iterator lru;
+
+  }; // Entry
+
+  std::map<Key, Entry> _entries;
+  std::list<Key> _lru; // most recently used first
+  std::mutex _mutex;
+  std::condition_variable _built;
+  std::filesystem::path _cacheDirectory;
+  size_t _budget{TriangleMeshShape::defaultBVHCacheBudget};
+  uint64_t _hits{};
+  uint64_t _misses{};
+  uint64_t _evictions{};
+
+  // Must be called with the cache locked. The reference counts are
+  // atomic, and new references to a cached BVH, or to the mesh of a
+  // BVH referenced only by the cache, are taken only while the cache
+  // is locked, thus a BVH found unused cannot be used concurrently
+  void evict()
+  {
+    size_t memory{};
+
+    for (const auto& [key, e] : _entries)
+      if (e.bvh != nullptr)
+        memory += e.bvh->memorySize();
+    for (auto lit = _lru.end(); lit != _lru.begin();)
+    {
+      auto eit = _entries.find(*--lit);
+      const auto& bvh = eit->second.bvh;
+
+      // A BVH referenced only by the cache is not used by any shape
+      if (bvh->referenceCount() > 1)
+        continue;
+      if (memory <= _budget && bvh->mesh()->referenceCount() > 1)
+        continue;
+      memory -= bvh->memorySize();
+      _entries.erase(eit);
+      lit = _lru.erase(lit);
+      ++_evictions;
+    }
+  }
+
+  static TriangleMeshBVH* makeBVH(const TriangleMesh& mesh,
+    const std::filesystem::path& cacheDirectory)
+  {
+    namespace fs = std::filesystem;
+
+    fs::path path;
+
+    if (!cacheDirectory.empty())
+    {
+      // BVH files are named after their keys. A file that cannot be
+      // loaded, because it is corrupt or stale, is rewritten
+      auto key = TriangleMeshBVH::fileKey(mesh, 64, BVHBase::SplitMethod::SAH);
+      char name[32];
+
+      snprintf(name, sizeof name, "%016llx.bvh", (unsigned long long)key);
+      path = cacheDirectory / name;
+      if (auto bvh = TriangleMeshBVH::load(path.string().c_str(), mesh))
+        return bvh;
     }
 #ifdef _DEBUG
     printf("**Building BVH for mesh %d\n", mesh.id);
 #endif // _DEBUG
 
-    auto* bvh = new TriangleMeshBVH{mesh};
+    auto bvh = new TriangleMeshBVH{mesh};
+
+    if (!path.empty())
+    {
+      // Write to a temporary file first, so that a partially written
+      // file is never loaded
+      auto temp = path;
+      std::error_code ec;
+
+      temp += ".tmp";
 
-    _map.emplace(mesh.id, bvh);
+      auto saved = bvh->save(temp.string().c_str());
+
+      if (saved)
+        fs::rename(temp, path, ec);
+      // A file that cannot be written or renamed is not left behind
+      if (!saved || ec)
+        fs::remove(temp, ec);
+    }
     return bvh;
   }
 
-private:
-  BVHMap _map;
+}; // BVHCache
 
-}; // BVHBuilder
+static BVHCache _bvhCache;
 
-static BVHBuilder _bvhBuilder;
+// A refitted BVH whose SAH cost is greater than this ratio times its
+// cost when built is rebuilt
+static constexpr auto maxBVHCostRatio = 2.0f;
 
 TriangleMeshShape::TriangleMeshShape(const TriangleMesh& mesh):
   _mesh{&mesh}
@@ -83,6 +263,9 @@ TriangleMeshShape::setMesh(const TriangleMesh& mesh)
 {
   if (_mesh != &mesh)
   {
+    std::lock_guard lock{_bvhLock};
+
+    _bvhPointer = nullptr;
     _bvh = nullptr;
     _mesh = &mesh;
   }
@@ -100,12 +283,62 @@ TriangleMeshShape::canIntersect() const
   return true;
 }
 
+void
+TriangleMeshShape::setBVHCacheDirectory(const char* path)
+{
+  _bvhCache.setCacheDirectory(path);
+}
+
+void
+TriangleMeshShape::setBVHCacheBudget(size_t budget)
+{
+  _bvhCache.setBudget(budget);
+}
+
+TriangleMeshShape::BVHCacheStatistics
+TriangleMeshShape::bvhCacheStatistics()
+{
+  return _bvhCache.statistics();
+}
+
+void
+TriangleMeshShape::setBVHWidth(uint32_t width)
+{
+  if (width != 2 && width != 4 && width != 8)
+    throw std::logic_error("TriangleMeshShape: bad BVH width");
+
+  std::lock_guard lock{_bvhLock};
+
+  // The BVH shared with other shapes is not changed: the one of the
+  // new width is fetched from the cache on the next use
+  if (width != _bvhWidth)
+  {
+    _bvhPointer = nullptr;
+    _bvh = nullptr;
+    _bvhWidth = width;
+  }
+}
+
 TriangleMeshBVH*
 TriangleMeshShape::bvh() const
 {
-  if (_bvh == nullptr)
-    _bvh = _bvhBuilder.bvh(*_mesh);
-  return _bvh;
+  // The BVH is fetched from the cache once, by the first of any
+  // concurrent callers; the others wait for it
+  auto bvh = _bvhPointer.load(std::memory_order_acquire);
+
+  if (bvh == nullptr)
+  {
+    std::lock_guard lock{_bvhLock};
+
+    if (_bvh == nullptr)
+      _bvhCache.getBVH(*_mesh, _bvhWidth, _bvh);
+    _bvhPointer.store(bvh = _bvh, std::memory_order_release);
+  }
+  // The BVH of a deforming mesh is refitted to the current vertices.
+  // The BVH is shared by other shapes, thus its refits are serialized
+  if (bvh->isStale())
+    bvh->refitIfStale(maxBVHCostRatio);
+  return bvh;
 }
 
 bool